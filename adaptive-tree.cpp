@@ -0,0 +1,354 @@
+/*
+ * C++ Adaptive Splay/AVL Tree implementation
+ * Written by orestisp
+ * std06176@di.uoa.gr
+ */
+
+
+
+#define NO_TESTING_MAIN
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include "iterative-avl-tree.cpp"
+#include "splay-tree.cpp"
+
+
+/*
+ * Keeps its keys either in a splay tree or in an AVL tree and moves them
+ * (in linear time) to the other one when it looks cheaper. One operation
+ * in SAMPLE is sampled: its key goes to the front of a list of the last
+ * RECENT distinct sampled keys, and the cost of the access is measured on
+ * the current tree (search depth) and estimated for the other one. For
+ * the splay tree the estimate is the working set bound, log of the number
+ * of distinct keys sampled since the key was last sampled (its place in
+ * the list), or log n when it is not there. Counting only sampled keys
+ * takes the operations in between to draw from the same keys. Every
+ * WINDOW samples the averages are compared and the tree is switched if
+ * the other one is cheaper by more than a quarter.
+ */
+
+template <class T>
+class ADAPT {
+	private:
+		enum { SAMPLE = 16, RECENT = 256, WINDOW = 256 };
+		SP<T> sp;
+		AVL<T> avl;
+		bool splay_mode;
+		std::vector<T> recent;
+		unsigned int tick;
+		unsigned int samples;
+		unsigned int recent_hits;
+		unsigned int depth_samples;
+		double depth_sum;
+		double sp_sum;
+		double avl_sum;
+		double sp_cost;
+		double avl_cost;
+		double depth_avg;
+		double locality_var;
+		unsigned int switches_var;
+		void ADAPT_sample(const T&, bool);
+		void ADAPT_decide(void);
+		void ADAPT_migrate(void);
+		void ADAPT_reset(void);
+	public:
+		ADAPT(void);
+		bool empty(void) const;
+		unsigned int size(void) const;
+		ADAPT<T>& clear(void);
+		bool find(const T&);
+		ADAPT<T>& insert(const T&);
+		ADAPT<T>& extract(const T&);
+		void print(void) const;
+		bool splaying(void) const;
+		unsigned int switches(void) const;
+		double average_depth(void) const;
+		double locality(void) const;
+		double splay_cost(void) const;
+		double tree_cost(void) const;
+};
+
+
+/* Relative cost of a splay step (rotations and writes) to an AVL step */
+static const double ADAPT_SPLAY_WEIGHT = 2.0;
+
+
+template <class T>
+void ADAPT<T>::ADAPT_sample(const T& d, bool lookup) {
+	unsigned int i, n = recent.size();
+	double lg = std::log2((double)size()+1), s = lg, a = lg;
+	for (i = 0 ; i < n && !(recent[i] == d) ; i++) ;
+	if (i < n) {
+		if (std::log2((double)i+2) < s) s = std::log2((double)i+2);
+		recent_hits++;
+		std::rotate(recent.begin(), recent.begin()+i, recent.begin()+i+1);
+	} else {
+		if (n < RECENT) recent.push_back(d);
+		else recent.back() = d;
+		std::rotate(recent.begin(), recent.end()-1, recent.end());
+	}
+	if (lookup) {
+		double c = splay_mode ? sp.depth(d) : avl.depth(d);
+		if (splay_mode) s = c;
+		else a = c;
+		depth_sum += c;
+		depth_samples++;
+	}
+	sp_sum += ADAPT_SPLAY_WEIGHT*s;
+	avl_sum += a;
+	if (++samples == WINDOW) ADAPT_decide();
+}
+
+
+template <class T>
+void ADAPT<T>::ADAPT_decide(void) {
+	sp_cost = sp_sum/samples;
+	avl_cost = avl_sum/samples;
+	locality_var = (double)recent_hits/samples;
+	if (depth_samples) depth_avg = depth_sum/depth_samples;
+	samples = recent_hits = depth_samples = 0;
+	depth_sum = sp_sum = avl_sum = 0;
+	if (splay_mode ? sp_cost > 1.25*avl_cost : 1.25*sp_cost < avl_cost)
+		ADAPT_migrate();
+}
+
+
+template <class T>
+void ADAPT<T>::ADAPT_migrate(void) {
+	std::vector<T> a;
+	a.reserve(size());
+	if (splay_mode) {
+		sp.for_each([&a](const T& d) { a.push_back(d); });
+		avl.build(a.empty() ? 0 : &a[0], a.size());
+		sp.clear();
+	} else {
+		avl.for_each([&a](const T& d) { a.push_back(d); });
+		sp.build(a.empty() ? 0 : &a[0], a.size());
+		avl.clear();
+	}
+	splay_mode = !splay_mode;
+	switches_var++;
+}
+
+
+/* Forgets the sampled keys and every statistic taken from them */
+template <class T>
+void ADAPT<T>::ADAPT_reset(void) {
+	recent.clear();
+	tick = samples = recent_hits = depth_samples = 0;
+	depth_sum = sp_sum = avl_sum = 0;
+	sp_cost = avl_cost = depth_avg = locality_var = 0;
+}
+
+
+template <class T>
+ADAPT<T>::ADAPT(void):
+	splay_mode(false), tick(0), samples(0), recent_hits(0),
+	depth_samples(0), depth_sum(0), sp_sum(0), avl_sum(0), sp_cost(0),
+	avl_cost(0), depth_avg(0), locality_var(0), switches_var(0) {}
+
+
+template <class T>
+bool ADAPT<T>::empty(void) const {
+	return size() == 0;
+}
+
+
+template <class T>
+unsigned int ADAPT<T>::size(void) const {
+	return splay_mode ? sp.size() : avl.size();
+}
+
+
+template <class T>
+ADAPT<T>& ADAPT<T>::clear(void) {
+	sp.clear();
+	avl.clear();
+	ADAPT_reset();
+	return *this;
+}
+
+
+template <class T>
+bool ADAPT<T>::find(const T& d) {
+	if (++tick%SAMPLE == 0) ADAPT_sample(d, true);
+	return splay_mode ? sp.find(d) : avl.find(d);
+}
+
+
+template <class T>
+ADAPT<T>& ADAPT<T>::insert(const T& d) {
+	if (++tick%SAMPLE == 0) ADAPT_sample(d, false);
+	if (splay_mode) sp.insert(d);
+	else avl.insert(d);
+	return *this;
+}
+
+
+template <class T>
+ADAPT<T>& ADAPT<T>::extract(const T& d) {
+	if (++tick%SAMPLE == 0) ADAPT_sample(d, false);
+	if (splay_mode) sp.extract(d);
+	else avl.extract(d);
+	return *this;
+}
+
+
+template <class T>
+void ADAPT<T>::print(void) const {
+	if (splay_mode) sp.print();
+	else avl.print();
+}
+
+
+template <class T>
+bool ADAPT<T>::splaying(void) const {
+	return splay_mode;
+}
+
+
+template <class T>
+unsigned int ADAPT<T>::switches(void) const {
+	return switches_var;
+}
+
+
+template <class T>
+double ADAPT<T>::average_depth(void) const {
+	return depth_avg;
+}
+
+
+template <class T>
+double ADAPT<T>::locality(void) const {
+	return locality_var;
+}
+
+
+template <class T>
+double ADAPT<T>::splay_cost(void) const {
+	return sp_cost;
+}
+
+
+template <class T>
+double ADAPT<T>::tree_cost(void) const {
+	return avl_cost;
+}
+
+
+
+/* Testing main */
+
+#ifndef NO_ADAPTIVE_MAIN
+
+#include <cstdlib>
+#include <ctime>
+#include "perf-counters.h"
+using namespace std;
+
+
+template <class T>
+static void report(const ADAPT<T>& tree) {
+	cout << "Using " << (tree.splaying() ? "splay" : "AVL") << " tree"
+	     << " (depth " << tree.average_depth()
+	     << ", locality " << tree.locality()
+	     << ", splay cost " << tree.splay_cost()
+	     << ", AVL cost " << tree.tree_cost()
+	     << ", switches " << tree.switches() << ")" << endl;
+}
+
+
+int main(int argc, char **argv)
+{
+	int i, j, n;
+	double t;
+	PERF perf;
+	ADAPT<int> tree;
+	if (argc > 3) return EXIT_FAILURE;
+	i = time(0);
+	if (argc == 1) n = 20;
+	else {
+		n = atoi(argv[1]);
+		if (argc == 3) i = atoi(argv[2]);
+	}
+	srand((unsigned int)i);
+	cout << "Size is " << n << endl;
+	cout << "Seed is " << i << endl;
+	cout << "Inserting..." << endl;
+	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
+	for (i = 1 ; i <= n ; i++) {
+		j = rand()%n+1;
+		tree.insert(j);
+	}
+	perf.stop();
+	t = ((double)clock())/CLOCKS_PER_SEC-t;
+	cout << t << " secs" << endl;
+	perf.report(n);
+	report(tree);
+	cout << "Uniform lookups..." << endl;
+	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
+	for (i = 1 ; i <= 4*n ; i++) {
+		j = rand()%n+1;
+		tree.find(j);
+	}
+	perf.stop();
+	t = ((double)clock())/CLOCKS_PER_SEC-t;
+	cout << t << " secs" << endl;
+	perf.report(4*n);
+	report(tree);
+	cout << "Skewed lookups..." << endl;
+	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
+	for (i = 1 ; i <= 4*n ; i++) {
+		j = rand()%16+1;
+		tree.find(j);
+	}
+	perf.stop();
+	t = ((double)clock())/CLOCKS_PER_SEC-t;
+	cout << t << " secs" << endl;
+	perf.report(4*n);
+	report(tree);
+	cout << "Uniform lookups..." << endl;
+	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
+	for (i = 1 ; i <= 4*n ; i++) {
+		j = rand()%n+1;
+		tree.find(j);
+	}
+	perf.stop();
+	t = ((double)clock())/CLOCKS_PER_SEC-t;
+	cout << t << " secs" << endl;
+	perf.report(4*n);
+	report(tree);
+	cout << "Size of tree is: " << tree.size() << endl;
+	cout << "Clearing..." << endl;
+	tree.clear();
+	cout << "Checking the switch on 65536 keys..." << endl;
+	n = 1 << 16;
+	for (i = 1 ; i <= n ; i++)
+		tree.insert(i);
+	for (i = 1 ; i <= n ; i++)
+		tree.find(rand()%16+1);
+	report(tree);
+	if (!tree.splaying()) {
+		cout << "16 hot keys did not switch to the splay tree" << endl;
+		return EXIT_FAILURE;
+	}
+	for (i = 1 ; i <= n ; i++)
+		tree.find(rand()%n+1);
+	report(tree);
+	if (tree.splaying()) {
+		cout << "Uniform lookups did not switch back to the AVL tree" << endl;
+		return EXIT_FAILURE;
+	}
+	tree.clear();
+	return EXIT_SUCCESS;
+}
+
+#endif
@@ -8,6 +8,14 @@
 
 #include <iostream>
 #include <fstream>
+#include <vector>
+#include <deque>
+#include <utility>
+#include <atomic>
+#include <thread>
+#include "bloom-filter.h"
+#include "parallel-traversal.h"
+#include "memory-usage.h"
 
 
 template <class T>
@@ -20,36 +28,126 @@ class BST {
 			node(const T& d):
 				data(d), left(0), right(0) {}
 		};
+		enum { IDLE, COPYING, REPLAYING };
+		struct rebuild {
+			unsigned int phase;
+			unsigned int work;
+			unsigned int built;
+			unsigned int size;
+			unsigned int dead;
+			bool walk;
+			node *level[33];
+			node *last;
+			node *shadow;
+			std::deque<std::pair<T, bool> > log;
+			std::vector<node*> stack;
+			std::vector<node*> garbage;
+			rebuild(void):
+				phase(IDLE), work(0), built(0), size(0), dead(0), walk(true), last(0), shadow(0) {}
+		};
 		node *root;
 		node **array;
 		unsigned int size_var;
-		void BST_clear(node*);
+		BLOOM<T> filter;
+		unsigned int filter_stale;
+		mutable std::atomic<unsigned long long> filter_rejects;
+		mutable std::atomic<unsigned long long> filter_false;
+		rebuild *rb;
+		unsigned long long limit_var;
+		unsigned int BST_clear(node*);
 		void BST_copy(node*&, node*);
+		static node* BST_unlink(node**);
+		node* BST_remove(node**);
+		bool BST_link(node*);
+		void BST_merge(node*, BST&);
 		void BST_to_array(node*, node***);
 		void BST_from_array(node*&, unsigned int, unsigned int);
+		void BST_from_array(node*&, unsigned int, unsigned int, unsigned int);
+		void BST_compress(unsigned int);
+		void BST_pieces(node*, unsigned int, std::vector<std::pair<node*, bool> >&);
+		static unsigned int BST_count(node*);
+		static void BST_fill(node*, node**);
+		template <class F> static void BST_run(unsigned int, F);
+		template <class F> void BST_for_each(node*, F&) const;
+		void BST_filter(void);
+		inline void BST_added(const T&);
+		inline void BST_stale(unsigned int);
+		inline bool BST_copied(const T&) const;
+		inline void BST_log(const T&, bool);
+		void BST_shadow_add(node*);
+		node* BST_shadow_finish(void);
+		void BST_replay(const std::pair<T, bool>&);
+		static unsigned int BST_free(node*&, unsigned int&);
+		void BST_abort(bool);
+		void BST_done(void);
+		inline void BST_work(void);
 		void BST_print(node*) const;
 		void BST_display(node*, std::ofstream&, unsigned int*) const;
 	public:
+		class node_handle {
+			friend class BST<T>;
+			private:
+				node *p;
+				explicit node_handle(node* n): p(n) {}
+				node_handle(const node_handle&);
+				node_handle& operator=(const node_handle&);
+			public:
+				node_handle(void): p(0) {}
+				node_handle(node_handle&& h): p(h.p) { h.p = 0; }
+				~node_handle(void) { delete p; }
+				node_handle& operator=(node_handle&& h) {
+					if (this != &h) {
+						delete p;
+						p = h.p;
+						h.p = 0;
+					}
+					return *this;
+				}
+				bool empty(void) const { return !p; }
+				T& value(void) const { return p->data; }
+		};
 		BST(void);
 		BST(const BST&);
+		BST(BST&&);
 		~BST(void);
+		BST<T>& operator=(const BST&);
+		BST<T>& operator=(BST&&);
+		BST<T>& swap(BST&);
 		bool empty(void) const;
 		unsigned int size(void) const;
 		BST<T>& clear(void);
 		bool find(const T&) const;
 		BST<T>& insert(const T&);
 		BST<T>& extract(const T&);
+		node_handle extract_node(const T&);
+		BST<T>& insert(node_handle&&);
+		BST<T>& merge(BST&);
+		BST<T>& erase_range(const T&, const T&);
 		BST<T>& balance(void);
+		BST<T>& balance_in_place(void);
+		BST<T>& balance_parallel(unsigned int = 0);
+		BST<T>& balance_incremental(unsigned int = 64);
+		bool balance_step(unsigned int);
+		template <class I> BST<T>& build_from_unsorted(I, I, unsigned int = 0);
+		template <class F> void parallel_for_each(F, unsigned int = 0) const;
+		template <class R, class M, class C> R parallel_reduce(R, M, C, unsigned int = 0) const;
 		BST<T>& print(void) const;
 		void display(std::ofstream&) const;
+		BST<T>& set_filter(unsigned int);
+		double filter_fpr(void) const;
+		unsigned long long filter_memory(void) const;
+		MEM_usage memory_usage(void) const;
+		BST<T>& set_memory_limit(unsigned long long);
 };
 
 
 template <class T>
-void BST<T>::BST_clear(node* p) {
-	if (p->left) BST_clear(p->left);
-	if (p->right) BST_clear(p->right);
+unsigned int BST<T>::BST_clear(node* p) {
+	unsigned int c = 1;
+	if (p->left) c += BST_clear(p->left);
+	if (p->right) c += BST_clear(p->right);
 	delete p;
+	return c;
 }
 
 
@@ -61,6 +159,73 @@ void BST<T>::BST_copy(node*& p, node* rp) {
 }
 
 
+/* Unlinks *p from whatever tree it is in and returns it, children cleared */
+template <class T>
+typename BST<T>::node* BST<T>::BST_unlink(node** p) {
+	node *t = *p;
+	if (!t->left)
+		*p = t->right;
+	else if (!t->right)
+		*p = t->left;
+	else {
+		node **r = p, *m;
+		p = &(t->right);
+		while ((*p)->left)
+			p = &((*p)->left);
+		m = *p;
+		*p = m->right;
+		m->left = t->left;
+		m->right = t->right;
+		*r = m;
+	}
+	t->left = t->right = 0;
+	return t;
+}
+
+
+/* Unlinks *p and returns it, children cleared, without freeing it */
+template <class T>
+typename BST<T>::node* BST<T>::BST_remove(node** p) {
+	node *t = *p;
+	bool two = t->left && t->right;
+	BST_log(t->data, false);
+	t = BST_unlink(p);
+	if (two && rb && rb->phase == COPYING && !BST_copied((*p)->data)) rb->walk = true;
+	size_var--;
+	BST_stale(1);
+	return t;
+}
+
+
+/* Links a detached node in place of a leaf; false if its key is there */
+template <class T>
+bool BST<T>::BST_link(node* n) {
+	node **p = &root;
+	while (*p)
+		if (n->data < (*p)->data)
+			p = &((*p)->left);
+		else if (!(n->data == (*p)->data))
+			p = &((*p)->right);
+		else return false;
+	BST_log(n->data, true);
+	n->left = n->right = 0;
+	*p = n;
+	size_var++;
+	BST_added(n->data);
+	return true;
+}
+
+
+/* Moves the nodes of p (preorder, so shapes are kept) here or back into param */
+template <class T>
+void BST<T>::BST_merge(node* p, BST& param) {
+	node *l = p->left, *r = p->right;
+	if (!BST_link(p)) param.BST_link(p);
+	if (l) BST_merge(l, param);
+	if (r) BST_merge(r, param);
+}
+
+
 template <class T>
 void BST<T>::BST_to_array(node* p, node*** a) {
 	if (p->left) BST_to_array(p->left, a);
@@ -85,6 +250,294 @@ void BST<T>::BST_from_array(node*& p, unsigned int low, unsigned int high) {
 }
 
 
+template <class T>
+void BST<T>::BST_from_array(node*& p, unsigned int low, unsigned int high,
+                            unsigned int par) {
+	if (!par || high-low < 4096) {
+		BST_from_array(p, low, high);
+		return;
+	}
+	unsigned int mid = (low+high) >> 1;
+	std::thread w;
+	p = array[mid];
+	try {
+		w = std::thread([=]() { BST_from_array(array[mid]->left, low, mid-1, par-1); });
+	} catch (...) {}
+	BST_from_array(p->right, mid+1, high, par-1);
+	if (w.joinable()) w.join();
+	else BST_from_array(p->left, low, mid-1, par-1);
+}
+
+
+template <class T>
+void BST<T>::BST_compress(unsigned int n) {
+	node *t, **p = &root;
+	while (n--) {
+		t = *p;
+		*p = t->right;
+		t->right = (*p)->left;
+		(*p)->left = t;
+		p = &((*p)->right);
+	}
+}
+
+
+template <class T>
+void BST<T>::BST_pieces(node* p, unsigned int d,
+                        std::vector<std::pair<node*, bool> >& v) {
+	if (!d) {
+		v.push_back(std::make_pair(p, true));
+		return;
+	}
+	if (p->left) BST_pieces(p->left, d-1, v);
+	v.push_back(std::make_pair(p, false));
+	if (p->right) BST_pieces(p->right, d-1, v);
+}
+
+
+template <class T>
+unsigned int BST<T>::BST_count(node* p) {
+	std::vector<node*> s(1, p);
+	unsigned int c = 0;
+	while (!s.empty()) {
+		p = s.back();
+		s.pop_back();
+		c++;
+		if (p->left) s.push_back(p->left);
+		if (p->right) s.push_back(p->right);
+	}
+	return c;
+}
+
+
+template <class T>
+void BST<T>::BST_fill(node* p, node** a) {
+	std::vector<node*> s;
+	while (p || !s.empty()) {
+		while (p) {
+			s.push_back(p);
+			p = p->left;
+		}
+		p = s.back();
+		s.pop_back();
+		*a++ = p;
+		p = p->right;
+	}
+}
+
+
+template <class T>
+template <class F>
+void BST<T>::BST_run(unsigned int threads, F f) {
+	std::vector<std::thread> w;
+	try {
+		while (w.size()+1 < threads)
+			w.push_back(std::thread(f));
+	} catch (...) {}
+	f();
+	for (unsigned int i = 0 ; i < w.size() ; i++)
+		w[i].join();
+}
+
+
+template <class T>
+template <class F>
+void BST<T>::BST_for_each(node* p, F& f) const {
+	if (p->left) BST_for_each(p->left, f);
+	f(p->data);
+	if (p->right) BST_for_each(p->right, f);
+}
+
+
+/*
+ * Refills the filter from the tree with room for half as many keys again,
+ * as the tree outgrows it or once removed keys outnumber half the tree.
+ * If the new filter cannot be allocated the old one, still correct, is kept.
+ */
+template <class T>
+void BST<T>::BST_filter(void) {
+	BLOOM<T> t;
+	BLOOM_adder<T> f(t);
+	try {
+		t.reset(size_var+size_var/2+64, filter.bits_per_key());
+	} catch (...) {
+		return;
+	}
+	if (root) BST_for_each(root, f);
+	filter.swap(t);
+	filter_stale = 0;
+}
+
+
+template <class T>
+inline void BST<T>::BST_added(const T& d) {
+	if (!filter.enabled()) return;
+	filter.add(d);
+	if (size_var > filter.capacity()) BST_filter();
+}
+
+
+template <class T>
+inline void BST<T>::BST_stale(unsigned int n) {
+	if (filter.enabled() && (filter_stale += n) > size_var/2+64) BST_filter();
+}
+
+
+/*
+ * Incremental balance: the keys are copied in order into new nodes that
+ * are linked balanced as they come (the shadow), a bounded number per
+ * step. The in-order stack is kept from one step to the next; changes
+ * to keys already copied are logged and replayed on the shadow, which
+ * then replaces the tree, and a change to any other key makes the next
+ * step find its place again from the root. The old nodes are freed by
+ * the following steps. The state lives on the heap only while a balance
+ * or the freeing of its old nodes is in progress.
+ */
+template <class T>
+inline bool BST<T>::BST_copied(const T& d) const {
+	return rb->last && !(rb->last->data < d);
+}
+
+
+template <class T>
+inline void BST<T>::BST_log(const T& d, bool ins) {
+	if (!rb || rb->phase == IDLE) return;
+	if (rb->phase == REPLAYING || BST_copied(d))
+		rb->log.push_back(std::make_pair(d, ins));
+	else rb->walk = true;
+}
+
+
+/*
+ * Node i (from 1) of the shadow has height h, the trailing zeros of i, as
+ * in a perfect tree of its keys in order: its left child is the last node
+ * of height h-1 and it is the right child of the last of height h+1 when
+ * bit h+1 of i is set. level[h] keeps the last node of each height.
+ */
+template <class T>
+void BST<T>::BST_shadow_add(node* n) {
+	unsigned int i = ++rb->built, h = __builtin_ctz(i);
+	n->left = h ? rb->level[h-1] : 0;
+	n->right = 0;
+	if (i >> (h+1) & 1) rb->level[h+1]->right = n;
+	rb->level[h] = n;
+	rb->last = n;
+	rb->size++;
+}
+
+
+/*
+ * Links the right edge of the shadow: a missing node of the perfect tree
+ * is replaced by its left child, down to a node there is. Returns the root.
+ */
+template <class T>
+typename BST<T>::node* BST<T>::BST_shadow_finish(void) {
+	unsigned long long n = rb->built, i, r;
+	unsigned int h, k = 0;
+	auto resolve = [&](unsigned long long j, unsigned int g) -> node* {
+		while (j > n) {
+			if (!g) return 0;
+			j -= 1ULL << --g;
+		}
+		return rb->level[g];
+	};
+	if (!n) return 0;
+	for (h = 1 ; n >= 1ULL << h ; h++) {
+		i = ((n-(1ULL << h)) >> (h+1) << (h+1))+(1ULL << h);
+		r = i+(1ULL << (h-1));
+		if (r > n) rb->level[h]->right = resolve(r, h-1);
+	}
+	while ((1ULL << k)-1 < n) k++;
+	return resolve(1ULL << (k-1), k-1);
+}
+
+
+template <class T>
+void BST<T>::BST_replay(const std::pair<T, bool>& o) {
+	node **p = &rb->shadow;
+	while (*p)
+		if (o.first < (*p)->data)
+			p = &((*p)->left);
+		else if (!(o.first == (*p)->data))
+			p = &((*p)->right);
+		else break;
+	if (o.second && !*p) {
+		*p = new node(o.first);
+		rb->size++;
+	} else if (!o.second && *p) {
+		delete BST_unlink(p);
+		rb->size--;
+	}
+}
+
+
+/* Frees up to budget nodes of p, rotating left children up so no stack is needed; returns how many */
+template <class T>
+unsigned int BST<T>::BST_free(node*& p, unsigned int& budget) {
+	node *t;
+	unsigned int c = 0;
+	for (; p && budget ; budget--)
+		if (p->left) {
+			t = p->left;
+			p->left = t->right;
+			t->right = p;
+			p = t;
+		} else {
+			t = p;
+			p = p->right;
+			delete t;
+			c++;
+		}
+	return c;
+}
+
+
+/* Drops an incremental balance; its nodes are freed by later steps, or now */
+template <class T>
+void BST<T>::BST_abort(bool now) {
+	node *p;
+	unsigned int b, n;
+	if (!rb) return;
+	p = rb->phase == COPYING ? BST_shadow_finish() : rb->shadow;
+	n = rb->size;
+	rb->phase = IDLE;
+	rb->built = rb->size = 0;
+	rb->last = rb->shadow = 0;
+	rb->log.clear();
+	rb->stack.clear();
+	if (p && !now) {
+		rb->garbage.push_back(p);
+		rb->dead += n;
+	} else while (p) {
+		b = ~0u;
+		BST_free(p, b);
+	}
+	if (now) BST_done();
+}
+
+
+/* Releases the state of an incremental balance once nothing is left of it */
+template <class T>
+void BST<T>::BST_done(void) {
+	if (rb && rb->phase == IDLE && rb->garbage.empty()) {
+		delete rb;
+		rb = 0;
+	}
+}
+
+
+/* The share of an incremental balance done by every insert and extract */
+template <class T>
+inline void BST<T>::BST_work(void) {
+	if (!rb || !rb->work) return;
+	try {
+		balance_step(rb->work);
+	} catch (...) {
+		BST_abort(true);
+	}
+}
+
+
 template <class T>
 void BST<T>::BST_print(node* p) const {
 	if (p->left) BST_print(p->left);
@@ -110,12 +563,14 @@ void BST<T>::BST_display(node* p, std::ofstream& out, unsigned int *c) const {
 
 template <class T>
 BST<T>::BST(void):
-	root(0), size_var(0) {}
+	root(0), size_var(0), filter_stale(0), filter_rejects(0), filter_false(0), rb(0), limit_var(0) {}
 
 
 template <class T>
 BST<T>::BST(const BST& param):
-	root(0), size_var(param.size_var) {
+	root(0), size_var(param.size_var), filter(param.filter),
+	filter_stale(param.filter_stale), filter_rejects(0), filter_false(0),
+	rb(0), limit_var(param.limit_var) {
 	if (param.root) {
 		try {
 			BST_copy(root, param.root);
@@ -127,12 +582,50 @@ BST<T>::BST(const BST& param):
 }
 
 
+template <class T>
+BST<T>::BST(BST&& param):
+	root(0), size_var(0), filter_stale(0), filter_rejects(0), filter_false(0), rb(0), limit_var(0) {
+	swap(param);
+}
+
+
 template <class T>
 BST<T>::~BST(void) {
 	clear();
 }
 
 
+template <class T>
+BST<T>& BST<T>::operator=(const BST& param) {
+	BST<T> t(param);
+	return swap(t);
+}
+
+
+template <class T>
+BST<T>& BST<T>::operator=(BST&& param) {
+	if (this != &param) {
+		clear();
+		swap(param);
+	}
+	return *this;
+}
+
+
+template <class T>
+BST<T>& BST<T>::swap(BST& param) {
+	std::swap(root, param.root);
+	std::swap(size_var, param.size_var);
+	filter.swap(param.filter);
+	std::swap(filter_stale, param.filter_stale);
+	filter_rejects = param.filter_rejects.exchange(filter_rejects);
+	filter_false = param.filter_false.exchange(filter_false);
+	std::swap(rb, param.rb);
+	std::swap(limit_var, param.limit_var);
+	return *this;
+}
+
+
 template <class T>
 bool BST<T>::empty(void) const {
 	return size_var == 0;
@@ -147,44 +640,71 @@ unsigned int BST<T>::size(void) const {
 
 template <class T>
 BST<T>& BST<T>::clear(void) {
+	unsigned int b;
+	BST_abort(true);
+	for (; rb && !rb->garbage.empty() ; rb->garbage.pop_back())
+		while (rb->garbage.back()) {
+			b = ~0u;
+			BST_free(rb->garbage.back(), b);
+		}
+	BST_done();
 	if (root) BST_clear(root);
 	root = 0;
 	size_var = 0;
+	filter.clear();
+	filter_stale = 0;
 	return *this;
 }
 
 
+/* With a filter most absent keys are turned away without touching the tree */
 template <class T>
 bool BST<T>::find(const T& d) const {
 	node *p = root;
+	if (filter.enabled() && !filter.contains(d)) {
+		filter_rejects.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
 	while (p)
 		if (d < p->data) 
 			p = p->left;
 		else if (!(d == p->data)) 
 			p = p->right;
 		else return true;
+	if (filter.enabled()) filter_false.fetch_add(1, std::memory_order_relaxed);
 	return false;
 }
 
 
 template <class T>
 BST<T>& BST<T>::insert(const T& d) {
-	node **p = &root;
+	node **p = &root, *n;
+	BST_work();
 	while (*p)
 		if (d < (*p)->data) 
 			p = &((*p)->left);
 		else if (!(d == (*p)->data)) 
 			p = &((*p)->right);
 		else return *this;
-	*p = new node(d);
+	if (limit_var) MEM_reserve(memory_usage(), MEM_chunk(sizeof(node)), limit_var);
+	n = new node(d);
+	try {
+		BST_log(d, true);
+	} catch (...) {
+		delete n;
+		throw;
+	}
+	*p = n;
 	size_var++;
+	BST_added(d);
 	return *this;
 }
 
 
 template <class T>
 BST<T>& BST<T>::extract(const T& d) {
-	node *t, **p = &root;
+	node **p = &root;
+	BST_work();
 	while (*p)
 		if (d < (*p)->data) 
 			p = &((*p)->left);
@@ -192,27 +712,88 @@ BST<T>& BST<T>::extract(const T& d) {
 			p = &((*p)->right);
 		else break;
 	if (!*p) return *this;
-	size_var--;
-	if (!(*p)->left) {
-		t = *p;
-		*p = (*p)->right;
-		delete t;
-	} else if (!(*p)->right) {
-		t = *p;
-		*p = (*p)->left;
-		delete t;
-	} else {
-		node **r = p;
-		p = &((*p)->right);
-		while ((*p)->left)
+	delete BST_remove(p);
+	return *this;
+}
+
+
+/* Unlinks the node of d without freeing it; the handle is empty if d is not here */
+template <class T>
+typename BST<T>::node_handle BST<T>::extract_node(const T& d) {
+	node **p = &root;
+	BST_work();
+	while (*p)
+		if (d < (*p)->data)
 			p = &((*p)->left);
-		t = *p;
-		*p = (*p)->right;
-		t->left = (*r)->left;
-		t->right = (*r)->right;
-		delete *r;
-		*r = t;
-	}
+		else if (!(d == (*p)->data))
+			p = &((*p)->right);
+		else return node_handle(BST_remove(p));
+	return node_handle();
+}
+
+
+/* Takes the node out of h, unless its key is already here; then h keeps it */
+template <class T>
+BST<T>& BST<T>::insert(node_handle&& h) {
+	BST_work();
+	if (h.p && BST_link(h.p)) h.p = 0;
+	return *this;
+}
+
+
+/* Moves every node of param whose key is not here, without allocating */
+template <class T>
+BST<T>& BST<T>::merge(BST& param) {
+	node *p = param.root;
+	if (&param == this || !p) return *this;
+	BST_abort(false);
+	param.BST_abort(false);
+	param.root = 0;
+	param.size_var = 0;
+	param.filter.clear();
+	param.filter_stale = 0;
+	BST_merge(p, param);
+	return *this;
+}
+
+
+template <class T>
+BST<T>& BST<T>::erase_range(const T& lo, const T& hi) {
+	node *t, **p = &root, **q;
+	unsigned int n = size_var;
+	if (hi < lo) return *this;
+	BST_abort(false);
+	while (*p)
+		if ((*p)->data < lo)
+			p = &((*p)->right);
+		else if (hi < (*p)->data)
+			p = &((*p)->left);
+		else break;
+	if (!*p) return *this;
+	q = &((*p)->left);
+	while (*q)
+		if ((*q)->data < lo)
+			q = &((*q)->right);
+		else {
+			t = *q;
+			*q = t->left;
+			if (t->right) size_var -= BST_clear(t->right);
+			delete t;
+			size_var--;
+		}
+	q = &((*p)->right);
+	while (*q)
+		if (hi < (*q)->data)
+			q = &((*q)->left);
+		else {
+			t = *q;
+			*q = t->right;
+			if (t->left) size_var -= BST_clear(t->left);
+			delete t;
+			size_var--;
+		}
+	BST_stale(n-size_var);
+	delete BST_remove(p);
 	return *this;
 }
 
@@ -221,14 +802,193 @@ template <class T>
 BST<T>& BST<T>::balance(void) {
 	node **t;
 	if (size_var <= 2) return *this;
+	if (limit_var) MEM_reserve(memory_usage(), MEM_chunk(size_var*sizeof(node*)), limit_var);
 	array = t = new node* [size_var];
 	BST_to_array(root, &t);
 	BST_from_array(root, 0, size_var-1);
 	delete[] array;
+	if (rb) rb->walk = true;
+	return *this;
+}
+
+
+template <class T>
+BST<T>& BST<T>::balance_in_place(void) {
+	node *t, **p = &root;
+	unsigned int m = 1;
+	if (size_var <= 2) return *this;
+	while (*p)
+		if ((*p)->left) {
+			t = *p;
+			*p = t->left;
+			t->left = (*p)->right;
+			(*p)->right = t;
+		} else p = &((*p)->right);
+	while (2*m+1 <= size_var) m = 2*m+1;
+	BST_compress(size_var-m);
+	while (m > 1) BST_compress(m >>= 1);
+	if (rb) rb->walk = true;
+	return *this;
+}
+
+
+template <class T>
+BST<T>& BST<T>::balance_parallel(unsigned int threads) {
+	std::vector<std::pair<node*, bool> > v;
+	std::vector<unsigned int> off;
+	std::atomic<unsigned int> next;
+	unsigned int i, d = 2, par = 0;
+	if (size_var <= 2) return *this;
+	if (!threads) threads = std::thread::hardware_concurrency();
+	if (!threads) threads = 1;
+	while ((1u << par) < threads) par++;
+	while ((1u << d) < 8*threads) d++;
+	if (limit_var) MEM_reserve(memory_usage(), MEM_chunk(size_var*sizeof(node*)), limit_var);
+	array = new node* [size_var];
+	BST_pieces(root, d, v);
+	off.assign(v.size()+1, 0);
+	next = 0;
+	BST_run(threads, [&]() {
+		for (unsigned int j ; (j = next++) < v.size() ; )
+			off[j+1] = v[j].second ? BST_count(v[j].first) : 1;
+	});
+	for (i = 0 ; i < v.size() ; i++)
+		off[i+1] += off[i];
+	next = 0;
+	BST_run(threads, [&]() {
+		for (unsigned int j ; (j = next++) < v.size() ; )
+			if (v[j].second) BST_fill(v[j].first, array+off[j]);
+			else array[off[j]] = v[j].first;
+	});
+	BST_from_array(root, 0, size_var-1, par);
+	delete[] array;
+	if (rb) rb->walk = true;
+	return *this;
+}
+
+
+/*
+ * Replaces the keys with those in [first, last), sorted and deduplicated
+ * in parallel. Each thread allocates the nodes of one slice of the keys
+ * in order, so a subtree mostly lies in one run of memory, and the
+ * balanced tree is linked over them as in balance_parallel.
+ */
+template <class T>
+template <class I>
+BST<T>& BST<T>::build_from_unsorted(I first, I last, unsigned int threads) {
+	std::vector<T> v(first, last);
+	node *t = 0;
+	unsigned int n, par = 0;
+	PAR_sort_unique(v, threads);
+	if (v.empty()) return clear();
+	if (limit_var)
+		MEM_reserve(memory_usage(), v.size()*MEM_chunk(sizeof(node))+
+		            MEM_chunk(v.size()*sizeof(node*)), limit_var);
+	n = PAR_threads(threads, v.size());
+	array = new node* [v.size()]();
+	try {
+		PAR_run(n, [&](unsigned int i) {
+			for (size_t k = v.size()*i/n ; k < v.size()*(i+1)/n ; k++)
+				array[k] = new node(v[k]);
+		});
+	} catch (...) {
+		for (size_t k = 0 ; k < v.size() ; k++)
+			delete array[k];
+		delete[] array;
+		throw;
+	}
+	while ((1u << par) < n) par++;
+	BST_from_array(t, 0, v.size()-1, par);
+	delete[] array;
+	clear();
+	root = t;
+	size_var = v.size();
+	if (filter.enabled()) BST_filter();
+	return *this;
+}
+
+
+/*
+ * Starts balancing the tree a little at a time: every later insert and
+ * extract does work steps of it (none if 0) and balance_step does more.
+ * A work of 1 is taken as 2, as one step a call could not keep up with
+ * the log those calls add. A step copies, replays or frees about one
+ * node, so work and budgets count nodes, not time, and no call pauses
+ * for long, except that finding the place again after a change to a key
+ * not yet copied costs a walk from the root. The balanced tree takes the
+ * place of the old one at once when complete. merge and erase_range
+ * abandon a balance in progress and leave its copy to later steps.
+ */
+template <class T>
+BST<T>& BST<T>::balance_incremental(unsigned int work) {
+	if (!rb) rb = new rebuild;
+	try {
+		rb->garbage.reserve(rb->garbage.size()+2);
+	} catch (...) {
+		BST_done();
+		throw;
+	}
+	BST_abort(false);
+	rb->work = work == 1 ? 2 : work;
+	rb->walk = true;
+	if (root) rb->phase = COPYING;
+	BST_done();
 	return *this;
 }
 
 
+/* Does up to budget steps of an incremental balance; true once nothing is left */
+template <class T>
+bool BST<T>::balance_step(unsigned int budget) {
+	node *p;
+	if (!rb) return true;
+	std::vector<node*>& s = rb->stack;
+	if (rb->phase == COPYING) {
+		if (rb->walk) {
+			s.clear();
+			for (p = root ; p ; )
+				if (!BST_copied(p->data)) {
+					s.push_back(p);
+					p = p->left;
+				} else p = p->right;
+			rb->walk = false;
+		}
+		for (; !s.empty() && budget ; budget--) {
+			p = s.back();
+			BST_shadow_add(new node(p->data));
+			s.pop_back();
+			for (p = p->right ; p ; p = p->left)
+				s.push_back(p);
+		}
+		if (!s.empty()) return false;
+		rb->shadow = BST_shadow_finish();
+		rb->phase = REPLAYING;
+	}
+	if (rb->phase == REPLAYING) {
+		for (; !rb->log.empty() && budget ; budget--) {
+			BST_replay(rb->log.front());
+			rb->log.pop_front();
+		}
+		if (!rb->log.empty()) return false;
+		if (root) {
+			rb->garbage.push_back(root);
+			rb->dead += size_var;
+		}
+		root = rb->shadow;
+		rb->phase = IDLE;
+		rb->built = rb->size = 0;
+		rb->last = rb->shadow = 0;
+	}
+	while (budget && !rb->garbage.empty()) {
+		rb->dead -= BST_free(rb->garbage.back(), budget);
+		if (!rb->garbage.back()) rb->garbage.pop_back();
+	}
+	if (!rb->garbage.empty()) return false;
+	BST_done();
+	return true;
+}
+
+
 template <class T>
 BST<T>& BST<T>::print(void) const {
 	if (root) BST_print(root);
@@ -248,10 +1008,101 @@ void BST<T>::display(std::ofstream& out) const {
 
 
 
+/*
+ * Puts a blocked Bloom filter of b bits per key in front of find, kept
+ * up by every update; b = 0 removes it. find counts its outcomes in
+ * relaxed atomics, so concurrent finds need no lock.
+ */
+template <class T>
+BST<T>& BST<T>::set_filter(unsigned int b) {
+	BLOOM_adder<T> f(filter);
+	filter.reset(size_var+size_var/2+64, b);
+	filter_stale = 0;
+	filter_rejects = filter_false = 0;
+	if (b && root) BST_for_each(root, f);
+	return *this;
+}
+
+
+/* Of the finds of absent keys since set_filter, the share the filter let through */
+template <class T>
+double BST<T>::filter_fpr(void) const {
+	unsigned long long n = filter_rejects+filter_false;
+	return n ? (double)filter_false/n : 0;
+}
+
+
+template <class T>
+unsigned long long BST<T>::filter_memory(void) const {
+	return filter.memory();
+}
+
+
+/*
+ * Besides the tree, the nodes of an incremental balance (the copy being
+ * built and the old tree still being freed) and its buffers count.
+ */
+template <class T>
+MEM_usage BST<T>::memory_usage(void) const {
+	MEM_usage u;
+	MEM_nodes(u, size_var, sizeof(node));
+	MEM_block(u, filter.memory());
+	if (!rb) return u;
+	MEM_nodes(u, (unsigned long long)rb->size+rb->dead, sizeof(node));
+	MEM_block(u, sizeof(rebuild));
+	MEM_deque(u, rb->log);
+	MEM_vector(u, rb->stack);
+	MEM_vector(u, rb->garbage);
+	return u;
+}
+
+
+/*
+ * Makes inserts, balance and build_from_unsorted throw std::bad_alloc,
+ * leaving the tree as it was, if they would take the heap use past bytes;
+ * 0 removes the limit. An incremental balance in progress is not held
+ * back by it.
+ */
+template <class T>
+BST<T>& BST<T>::set_memory_limit(unsigned long long bytes) {
+	limit_var = bytes;
+	return *this;
+}
+
+
+/*
+ * Calls f on every key from several threads, in no order; f must be
+ * thread safe. If it throws, the walk stops and the first exception is
+ * rethrown once every thread has finished.
+ */
+template <class T>
+template <class F>
+void BST<T>::parallel_for_each(F f, unsigned int threads) const {
+	PAR_for_each(root, size_var, f, threads);
+}
+
+
+/*
+ * combine(init, map(k)) over all keys k; combine must be associative and
+ * commutative. Exceptions from map or combine are passed on as by
+ * parallel_for_each.
+ */
+template <class T>
+template <class R, class M, class C>
+R BST<T>::parallel_reduce(R init, M map, C combine, unsigned int threads) const {
+	return PAR_reduce(root, size_var, init, map, combine, threads);
+}
+
+
 /* Testing main */
 
+#ifndef NO_TESTING_MAIN
+
 #include <cstdlib>
 #include <ctime>
+#include <chrono>
+#include <algorithm>
+#include "perf-counters.h"
 using namespace std;
 
 
@@ -259,6 +1110,7 @@ int main(int argc, char **argv)
 {
 	int i, j, n;
 	double t;
+	PERF perf;
 	BST<int> tree;
 	if (argc > 3) return EXIT_FAILURE;
 	i = time(0);
@@ -272,38 +1124,113 @@ int main(int argc, char **argv)
 	cout << "Seed is " << i << endl;
 	cout << "Inserting..." << endl;
 	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
 	for (i = 1 ; i <= n ; i++) {
 		j = rand()%n+1;
 	//	cout << j << ' ';
 		tree.insert(j);
 	}
+	perf.stop();
 	t = ((double)clock())/CLOCKS_PER_SEC-t;
 	cout << t << " secs" << endl;
+	perf.report(n);
 //	cout << "\nPrinting tree..." << endl;
 //	tree.print();
 	cout << "Size of tree is: " << tree.size() << endl;
+	cout << "Memory used is: " << tree.memory_usage() << endl;
 	ofstream out("bst.dot");
 	tree.display(out);
 	out.close();
 	system("dot bst.dot -Tpng -o bst.png");
 	cout << "Created tree image at bst.png!" << endl;
-//	tree.balance();
+	cout << "Balancing in place..." << endl;
+	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
+	tree.balance_in_place();
+	perf.stop();
+	t = ((double)clock())/CLOCKS_PER_SEC-t;
+	cout << t << " secs" << endl;
+	perf.report(n);
 	cout << "Extracting..." << endl;
 	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
 	for (i = 1 ; i <= n ; i++) {
 		j = rand()%n+1;
 	//	cout << j << ' ';
 		tree.extract(j);
 	}
+	perf.stop();
 	t = ((double)clock())/CLOCKS_PER_SEC-t;
 	cout << t << " secs" << endl;
+	perf.report(n);
 //	cout << "\nPrinting tree..." << endl;
 //	tree.print();
 	cout << "Size of tree is: " << tree.size() << endl;
+	cout << "Updating while balancing incrementally..." << endl;
+	double worst = 0;
+	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
+	tree.balance_incremental(64);
+	for (i = 1 ; i <= n ; i++) {
+		chrono::steady_clock::time_point c = chrono::steady_clock::now();
+		j = rand()%n+1;
+		if (i & 1) tree.insert(j);
+		else tree.extract(j);
+		worst = max(worst, chrono::duration<double>(chrono::steady_clock::now()-c).count());
+	}
+	while (!tree.balance_step(1024)) ;
+	perf.stop();
+	t = ((double)clock())/CLOCKS_PER_SEC-t;
+	cout << t << " secs, longest call " << worst*1e6 << " usecs" << endl;
+	perf.report(n);
+	cout << "Size of tree is: " << tree.size() << endl;
+	for (int k = 0 ; k < 2 ; k++) {
+		if (k) tree.set_filter(10);
+		cout << (k ? "Looking up with filter..." : "Looking up...") << endl;
+		t = ((double)clock())/CLOCKS_PER_SEC;
+		perf.start();
+		for (i = j = 0 ; i < n ; i++)
+			j += tree.find(rand()%n+1);
+		perf.stop();
+		t = ((double)clock())/CLOCKS_PER_SEC-t;
+		cout << t << " secs, " << j << " found" << endl;
+		perf.report(n);
+	}
+	cout << "Filter false positive rate is: " << tree.filter_fpr()
+	     << ", memory: " << tree.filter_memory() << " bytes" << endl;
+	cout << "Building from unsorted..." << endl;
+	vector<int> keys(n);
+	for (i = 0 ; i < n ; i++)
+		keys[i] = rand()%n+1;
+	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
+	tree.build_from_unsorted(keys.begin(), keys.end());
+	perf.stop();
+	t = ((double)clock())/CLOCKS_PER_SEC-t;
+	cout << t << " secs" << endl;
+	perf.report(n);
+	cout << "Size of tree is: " << tree.size() << endl;
+	for (int k = 1 ; k >= 0 ; k--) {
+		long long s;
+		cout << (k ? "Summing..." : "Summing in parallel...") << endl;
+		t = ((double)clock())/CLOCKS_PER_SEC;
+		perf.start();
+		s = tree.parallel_reduce(0LL, [](int d) { return (long long)d; },
+		                         [](long long a, long long b) { return a+b; }, k);
+		perf.stop();
+		t = ((double)clock())/CLOCKS_PER_SEC-t;
+		cout << t << " secs, sum is " << s << endl;
+		perf.report(n);
+	}
 	cout << "Clearing..." << endl;
 	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
 	tree.clear();
+	perf.stop();
 	t = ((double)clock())/CLOCKS_PER_SEC-t;
 	cout << t << " secs" << endl;
+	perf.report(n);
 	return EXIT_SUCCESS;
 }
+
+#endif
@@ -0,0 +1,213 @@
+/*
+ * C++ Blocked Bloom filter for the trees
+ * Written by orestisp
+ * std06176@di.uoa.gr
+ */
+
+
+
+#ifndef BLOOM_FILTER_H
+#define BLOOM_FILTER_H
+
+#include <cstring>
+#include <cmath>
+#include <functional>
+#include <utility>
+
+
+/*
+ * A Bloom filter split in 64 byte blocks: a key hashes to one block and
+ * sets or tests all its k bits there, so a lookup reads one cache line.
+ * Sized for a number of keys at a number of bits per key, with k =
+ * bits*ln 2. Keys cannot be removed; the trees rebuild their filter once
+ * enough of its keys are gone. An empty filter (no blocks) is disabled.
+ */
+
+template <class T, class H = std::hash<T> >
+class BLOOM {
+	private:
+		enum { WORDS = 8, BITS = 512 };
+		unsigned long long *mem;
+		unsigned long long *bits;
+		unsigned int blocks;
+		unsigned int probes;
+		unsigned int per_key;
+		unsigned long long capacity_var;
+		static inline unsigned long long BLOOM_hash(const T&);
+		void BLOOM_alloc(unsigned int);
+	public:
+		BLOOM(void);
+		BLOOM(const BLOOM&);
+		~BLOOM(void);
+		BLOOM& operator=(const BLOOM&);
+		BLOOM& swap(BLOOM&);
+		BLOOM& reset(unsigned long long, unsigned int);
+		BLOOM& clear(void);
+		bool enabled(void) const;
+		unsigned long long capacity(void) const;
+		unsigned int bits_per_key(void) const;
+		unsigned long long memory(void) const;
+		double estimate(void) const;
+		inline void add(const T&);
+		inline bool contains(const T&) const;
+};
+
+
+/* std::hash is often the identity, so the result is mixed (murmur3 finalizer) */
+template <class T, class H>
+inline unsigned long long BLOOM<T, H>::BLOOM_hash(const T& d) {
+	unsigned long long h = H()(d);
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+
+/* The blocks start on a 64 byte boundary inside mem */
+template <class T, class H>
+void BLOOM<T, H>::BLOOM_alloc(unsigned int n) {
+	mem = bits = 0;
+	blocks = n;
+	if (!n) return;
+	mem = new unsigned long long[(size_t)n*WORDS+WORDS-1];
+	bits = mem+((64-((size_t)mem & 63))&63)/sizeof(unsigned long long);
+	memset(bits, 0, (size_t)n*WORDS*sizeof(unsigned long long));
+}
+
+
+template <class T, class H>
+BLOOM<T, H>::BLOOM(void):
+	mem(0), bits(0), blocks(0), probes(0), per_key(0), capacity_var(0) {}
+
+
+template <class T, class H>
+BLOOM<T, H>::BLOOM(const BLOOM& param):
+	probes(param.probes), per_key(param.per_key), capacity_var(param.capacity_var) {
+	BLOOM_alloc(param.blocks);
+	if (blocks) memcpy(bits, param.bits, (size_t)blocks*WORDS*sizeof(unsigned long long));
+}
+
+
+template <class T, class H>
+BLOOM<T, H>::~BLOOM(void) {
+	delete[] mem;
+}
+
+
+template <class T, class H>
+BLOOM<T, H>& BLOOM<T, H>::operator=(const BLOOM& param) {
+	BLOOM<T, H> t(param);
+	return swap(t);
+}
+
+
+template <class T, class H>
+BLOOM<T, H>& BLOOM<T, H>::swap(BLOOM& param) {
+	std::swap(mem, param.mem);
+	std::swap(bits, param.bits);
+	std::swap(blocks, param.blocks);
+	std::swap(probes, param.probes);
+	std::swap(per_key, param.per_key);
+	std::swap(capacity_var, param.capacity_var);
+	return *this;
+}
+
+
+/* Empties the filter and sizes it for n keys at b bits each; b = 0 disables it */
+template <class T, class H>
+BLOOM<T, H>& BLOOM<T, H>::reset(unsigned long long n, unsigned int b) {
+	unsigned long long m = b ? (n*b+BITS-1)/BITS : 0;
+	BLOOM<T, H> t;
+	if (b && !m) m = 1;
+	t.BLOOM_alloc((unsigned int)m);
+	t.per_key = b;
+	t.capacity_var = b ? n : 0;
+	t.probes = (unsigned int)(b*0.693+0.5);
+	if (b && !t.probes) t.probes = 1;
+	if (t.probes > 16) t.probes = 16;
+	return swap(t);
+}
+
+
+template <class T, class H>
+BLOOM<T, H>& BLOOM<T, H>::clear(void) {
+	if (blocks) memset(bits, 0, (size_t)blocks*WORDS*sizeof(unsigned long long));
+	return *this;
+}
+
+
+template <class T, class H>
+bool BLOOM<T, H>::enabled(void) const {
+	return blocks != 0;
+}
+
+
+/* The number of keys the filter was sized for */
+template <class T, class H>
+unsigned long long BLOOM<T, H>::capacity(void) const {
+	return capacity_var;
+}
+
+
+template <class T, class H>
+unsigned int BLOOM<T, H>::bits_per_key(void) const {
+	return per_key;
+}
+
+
+/* Bytes of filter memory */
+template <class T, class H>
+unsigned long long BLOOM<T, H>::memory(void) const {
+	return blocks ? ((unsigned long long)blocks*WORDS+WORDS-1)*sizeof(unsigned long long) : 0;
+}
+
+
+/* False positive rate expected from how full the blocks are */
+template <class T, class H>
+double BLOOM<T, H>::estimate(void) const {
+	double r = 0;
+	unsigned int c;
+	for (unsigned int i = 0 ; i < blocks ; i++) {
+		c = 0;
+		for (unsigned int j = 0 ; j < WORDS ; j++)
+			c += __builtin_popcountll(bits[i*WORDS+j]);
+		r += std::pow((double)c/BITS, (double)probes);
+	}
+	return blocks ? r/blocks : 0;
+}
+
+
+/* The high half of the hash picks the block, the low half makes the k probes */
+template <class T, class H>
+inline void BLOOM<T, H>::add(const T& d) {
+	unsigned long long h = BLOOM_hash(d);
+	unsigned long long *b = bits+((h >> 32)*blocks >> 32)*WORDS;
+	unsigned int x = (unsigned int)h, y = (unsigned int)(h >> 23) | 1;
+	for (unsigned int i = 0 ; i < probes ; i++, x += y)
+		b[(x >> 6) & 7] |= 1ULL << (x & 63);
+}
+
+
+template <class T, class H>
+inline bool BLOOM<T, H>::contains(const T& d) const {
+	unsigned long long h = BLOOM_hash(d);
+	const unsigned long long *b = bits+((h >> 32)*blocks >> 32)*WORDS;
+	unsigned int x = (unsigned int)h, y = (unsigned int)(h >> 23) | 1;
+	for (unsigned int i = 0 ; i < probes ; i++, x += y)
+		if (!(b[(x >> 6) & 7] & (1ULL << (x & 63)))) return false;
+	return true;
+}
+
+
+/* Adds every key it is called with, for the trees' for_each */
+template <class T, class H = std::hash<T> >
+struct BLOOM_adder {
+	BLOOM<T, H>& filter;
+	BLOOM_adder(BLOOM<T, H>& f): filter(f) {}
+	void operator()(const T& d) const { filter.add(d); }
+};
+
+#endif
@@ -0,0 +1,569 @@
+/*
+ * C++ AVL Tree with sorted leaf buckets implementation
+ * Written by orestisp
+ * std06176@di.uoa.gr
+ */
+
+
+
+#include <iostream>
+#include <utility>
+
+
+/*
+ * Keys live only in the leaves, which are sorted arrays of up to B keys.
+ * Internal nodes hold a separator (keys < separator go left) and are kept
+ * AVL balanced, counting every leaf as height 0. A full leaf is split in
+ * two under a new internal node and an empty one is removed together with
+ * its parent. A leaf under a quarter full is merged with the next leaf
+ * under its sibling (the sibling itself or one of its children, as the
+ * parent is balanced) when both fit in one, and takes half the surplus
+ * of that leaf otherwise. T must be default constructible.
+ */
+
+template <class T, unsigned int B = 32>
+class BAVL {
+	private:
+		struct node {
+			int balance:2;
+			unsigned int leaf:1;
+			node(unsigned int l):
+				balance(0), leaf(l) {}
+		};
+		struct inner: node {
+			T data;
+			node *left;
+			node *right;
+			inner(const T& d):
+				node(0), data(d), left(0), right(0) {}
+		};
+		struct bucket: node {
+			unsigned int count;
+			T data[B];
+			bucket(void):
+				node(1), count(0) {}
+		};
+		node *root;
+		unsigned int size_var;
+		static inner* I(node* p) { return static_cast<inner*>(p); }
+		static bucket* L(node* p) { return static_cast<bucket*>(p); }
+		static inline unsigned int BAVL_search(const bucket*, const T&);
+		inline void BAVL_LL_rotate(node**);
+		inline void BAVL_RR_rotate(node**);
+		inline void BAVL_LR_rotate(node**);
+		inline void BAVL_RL_rotate(node**);
+		inline void BAVL_insert_unwind(node***, node***, bool*);
+		inline void BAVL_delete_unwind(node***, node***, bool*);
+		void BAVL_clear(node*);
+		void BAVL_copy(node*&, node*);
+		unsigned int BAVL_nodes(node*) const;
+		void BAVL_print(node*) const;
+	public:
+		BAVL(void);
+		BAVL(const BAVL&);
+		BAVL(BAVL&&);
+		~BAVL(void);
+		BAVL<T, B>& operator=(const BAVL&);
+		BAVL<T, B>& operator=(BAVL&&);
+		BAVL<T, B>& swap(BAVL&);
+		bool empty(void) const;
+		unsigned int size(void) const;
+		unsigned int nodes(void) const;
+		BAVL<T, B>& clear(void);
+		bool find(const T&) const;
+		BAVL<T, B>& insert(const T&);
+		BAVL<T, B>& extract(const T&);
+		void print(void) const;
+};
+
+
+/* Branch-free lower bound, the compare compiles to a conditional move */
+template <class T, unsigned int B>
+inline unsigned int BAVL<T, B>::BAVL_search(const bucket* k, const T& d) {
+	const T *p = k->data;
+	unsigned int h, n = k->count;
+	if (!n) return 0;
+	while (n > 1) {
+		h = n >> 1;
+		p = p[h] < d ? p+h : p;
+		n -= h;
+	}
+	return (p-k->data)+(*p < d);
+}
+
+
+template <class T, unsigned int B>
+inline void BAVL<T, B>::BAVL_LL_rotate(node** p) {
+	inner *t = I(*p);
+	*p = t->left;
+	t->left = I(*p)->right;
+	I(*p)->right = t;
+	t->balance = -(++(*p)->balance);
+}
+
+
+template <class T, unsigned int B>
+inline void BAVL<T, B>::BAVL_RR_rotate(node** p) {
+	inner *t = I(*p);
+	*p = t->right;
+	t->right = I(*p)->left;
+	I(*p)->left = t;
+	t->balance = -(--(*p)->balance);
+}
+
+
+template <class T, unsigned int B>
+inline void BAVL<T, B>::BAVL_LR_rotate(node** p) {
+	inner *t = I(*p), *l = I(t->left);
+	*p = l->right;
+	l->right = I(*p)->left;
+	t->left = I(*p)->right;
+	I(*p)->right = t;
+	I(*p)->left = l;
+	if ((*p)->balance != 1) {
+		l->balance = 0;
+		t->balance = -(*p)->balance;
+	} else {
+		l->balance = -1;
+		t->balance = 0;
+	}
+	(*p)->balance = 0;
+}
+
+
+template <class T, unsigned int B>
+inline void BAVL<T, B>::BAVL_RL_rotate(node** p) {
+	inner *t = I(*p), *l = I(t->right);
+	*p = l->left;
+	l->left = I(*p)->right;
+	t->right = I(*p)->left;
+	I(*p)->left = t;
+	I(*p)->right = l;
+	if ((*p)->balance != -1) {
+		l->balance = 0;
+		t->balance = -(*p)->balance;
+	} else {
+		l->balance = 1;
+		t->balance = 0;
+	}
+	(*p)->balance = 0;
+}
+
+
+template <class T, unsigned int B>
+inline void BAVL<T, B>::BAVL_insert_unwind(node*** s, node*** base, bool* b) {
+	node **p;
+	while (s != base) {
+		p = *s;
+		if (*b) {
+			if ((*p)->balance == -1) {
+				if (I(*p)->left->balance != 1)
+					BAVL_LL_rotate(p);
+				else
+					BAVL_LR_rotate(p);
+				return;
+			}
+			if (!--(*p)->balance) return;
+		} else {
+			if ((*p)->balance == 1) {
+				if (I(*p)->right->balance != -1)
+					BAVL_RR_rotate(p);
+				else
+					BAVL_RL_rotate(p);
+				return;
+			}
+			if (!++(*p)->balance) return;
+		}
+		b--;
+		s--;
+	}
+}
+
+
+template <class T, unsigned int B>
+inline void BAVL<T, B>::BAVL_delete_unwind(node*** s, node*** base, bool* b) {
+	node **p;
+	while (s != base) {
+		p = *s;
+		if (*b) {
+			if ((*p)->balance == 1) {
+				if (I(*p)->right->balance != -1) {
+					BAVL_RR_rotate(p);
+					if ((*p)->balance) return;
+				} else BAVL_RL_rotate(p);
+			} else if (++(*p)->balance) return;
+		} else {
+			if ((*p)->balance == -1) {
+				if (I(*p)->left->balance != 1) {
+					BAVL_LL_rotate(p);
+					if ((*p)->balance) return;
+				} else BAVL_LR_rotate(p);
+			} else if (--(*p)->balance) return;
+		}
+		b--;
+		s--;
+	}
+}
+
+
+/* A copy that threw halfway leaves null children behind */
+template <class T, unsigned int B>
+void BAVL<T, B>::BAVL_clear(node* p) {
+	if (!p) return;
+	if (p->leaf) {
+		delete L(p);
+		return;
+	}
+	BAVL_clear(I(p)->left);
+	BAVL_clear(I(p)->right);
+	delete I(p);
+}
+
+
+template <class T, unsigned int B>
+void BAVL<T, B>::BAVL_copy(node*& p, node* rp) {
+	if (rp->leaf) {
+		bucket *k = new bucket;
+		p = k;
+		for (unsigned int i = 0 ; i < L(rp)->count ; i++)
+			k->data[i] = L(rp)->data[i];
+		k->count = L(rp)->count;
+		return;
+	}
+	inner *q = new inner(I(rp)->data);
+	q->balance = rp->balance;
+	p = q;
+	BAVL_copy(q->left, I(rp)->left);
+	BAVL_copy(q->right, I(rp)->right);
+}
+
+
+template <class T, unsigned int B>
+unsigned int BAVL<T, B>::BAVL_nodes(node* p) const {
+	if (p->leaf) return 1;
+	return BAVL_nodes(I(p)->left)+BAVL_nodes(I(p)->right)+1;
+}
+
+
+template <class T, unsigned int B>
+void BAVL<T, B>::BAVL_print(node* p) const {
+	if (p->leaf) {
+		for (unsigned int i = 0 ; i < L(p)->count ; i++)
+			std::cout << L(p)->data[i] << ' ';
+		return;
+	}
+	BAVL_print(I(p)->left);
+	BAVL_print(I(p)->right);
+}
+
+
+template <class T, unsigned int B>
+BAVL<T, B>::BAVL(void):
+	root(0), size_var(0) {}
+
+
+template <class T, unsigned int B>
+BAVL<T, B>::BAVL(const BAVL& param):
+	root(0), size_var(param.size_var) {
+	if (param.root) {
+		try {
+			BAVL_copy(root, param.root);
+		} catch (...) {
+			clear();
+			throw;
+		}
+	}
+}
+
+
+template <class T, unsigned int B>
+BAVL<T, B>::BAVL(BAVL&& param):
+	root(param.root), size_var(param.size_var) {
+	param.root = 0;
+	param.size_var = 0;
+}
+
+
+template <class T, unsigned int B>
+BAVL<T, B>::~BAVL(void) {
+	clear();
+}
+
+
+template <class T, unsigned int B>
+BAVL<T, B>& BAVL<T, B>::operator=(const BAVL& param) {
+	BAVL<T, B> t(param);
+	return swap(t);
+}
+
+
+template <class T, unsigned int B>
+BAVL<T, B>& BAVL<T, B>::operator=(BAVL&& param) {
+	if (this != &param) {
+		clear();
+		swap(param);
+	}
+	return *this;
+}
+
+
+template <class T, unsigned int B>
+BAVL<T, B>& BAVL<T, B>::swap(BAVL& param) {
+	std::swap(root, param.root);
+	std::swap(size_var, param.size_var);
+	return *this;
+}
+
+
+template <class T, unsigned int B>
+bool BAVL<T, B>::empty(void) const {
+	return size_var == 0;
+}
+
+
+template <class T, unsigned int B>
+unsigned int BAVL<T, B>::size(void) const {
+	return size_var;
+}
+
+
+template <class T, unsigned int B>
+unsigned int BAVL<T, B>::nodes(void) const {
+	return root ? BAVL_nodes(root) : 0;
+}
+
+
+template <class T, unsigned int B>
+BAVL<T, B>& BAVL<T, B>::clear(void) {
+	if (root) BAVL_clear(root);
+	root = 0;
+	size_var = 0;
+	return *this;
+}
+
+
+template <class T, unsigned int B>
+bool BAVL<T, B>::find(const T& d) const {
+	node *p = root;
+	unsigned int i;
+	if (!p) return false;
+	while (!p->leaf)
+		p = d < I(p)->data ? I(p)->left : I(p)->right;
+	i = BAVL_search(L(p), d);
+	return i < L(p)->count && L(p)->data[i] == d;
+}
+
+
+template <class T, unsigned int B>
+BAVL<T, B>& BAVL<T, B>::insert(const T& d) {
+	node **pstack[sizeof(unsigned int)*12], ***s = pstack, **p = &root;
+	bool dstack[sizeof(unsigned int)*12], *b = dstack;
+	bucket *k, *r;
+	unsigned int i, j;
+	if (!root) {
+		k = new bucket;
+		k->data[0] = d;
+		k->count = 1;
+		root = k;
+		size_var++;
+		return *this;
+	}
+	while (!(*p)->leaf) {
+		*(++s) = p;
+		if ((*(++b) = (d < I(*p)->data)))
+			p = &(I(*p)->left);
+		else
+			p = &(I(*p)->right);
+	}
+	k = L(*p);
+	i = BAVL_search(k, d);
+	if (i < k->count && k->data[i] == d) return *this;
+	if (k->count < B) {
+		for (j = k->count ; j > i ; j--)
+			k->data[j] = k->data[j-1];
+		k->data[i] = d;
+		k->count++;
+		size_var++;
+		return *this;
+	}
+	r = new bucket;
+	inner *q;
+	try {
+		q = new inner(d);
+	} catch (...) {
+		delete r;
+		throw;
+	}
+	for (j = B/2 ; j < B ; j++)
+		r->data[j-B/2] = k->data[j];
+	r->count = B-B/2;
+	k->count = B/2;
+	if (i > B/2) {
+		k = r;
+		i -= B/2;
+	}
+	for (j = k->count ; j > i ; j--)
+		k->data[j] = k->data[j-1];
+	k->data[i] = d;
+	k->count++;
+	q->data = r->data[0];
+	q->left = *p;
+	q->right = r;
+	*p = q;
+	size_var++;
+	BAVL_insert_unwind(s, pstack, b);
+	return *this;
+}
+
+
+template <class T, unsigned int B>
+BAVL<T, B>& BAVL<T, B>::extract(const T& d) {
+	node **pstack[sizeof(unsigned int)*12], ***s = pstack, **p = &root;
+	bool dstack[sizeof(unsigned int)*12], *b = dstack;
+	bucket *k, *n;
+	node *o;
+	inner *q;
+	unsigned int i, m;
+	if (!root) return *this;
+	while (!(*p)->leaf) {
+		*(++s) = p;
+		if ((*(++b) = (d < I(*p)->data)))
+			p = &(I(*p)->left);
+		else
+			p = &(I(*p)->right);
+	}
+	k = L(*p);
+	i = BAVL_search(k, d);
+	if (i >= k->count || !(k->data[i] == d)) return *this;
+	for (k->count-- ; i < k->count ; i++)
+		k->data[i] = k->data[i+1];
+	size_var--;
+	if (s == pstack) {
+		if (!k->count) {
+			delete k;
+			root = 0;
+		}
+		return *this;
+	}
+	q = I(**s);
+	if (!k->count) {
+		**s = *b ? q->right : q->left;
+		delete k;
+	} else {
+		if (k->count >= B/4) return *this;
+		o = *b ? q->right : q->left;
+		n = L(o->leaf ? o : *b ? I(o)->left : I(o)->right);
+		if (k->count+n->count > B) {
+			m = (n->count-k->count)/2;
+			if (*b) {
+				for (i = 0 ; i < m ; i++)
+					k->data[k->count+i] = n->data[i];
+				for (i = m ; i < n->count ; i++)
+					n->data[i-m] = n->data[i];
+				q->data = n->data[0];
+			} else {
+				for (i = k->count ; i-- ; )
+					k->data[i+m] = k->data[i];
+				for (i = 0 ; i < m ; i++)
+					k->data[i] = n->data[n->count-m+i];
+				q->data = k->data[0];
+			}
+			k->count += m;
+			n->count -= m;
+			return *this;
+		}
+		if (*b) {
+			for (i = n->count ; i-- ; )
+				n->data[i+k->count] = n->data[i];
+			for (i = 0 ; i < k->count ; i++)
+				n->data[i] = k->data[i];
+		} else for (i = 0 ; i < k->count ; i++)
+			n->data[n->count+i] = k->data[i];
+		n->count += k->count;
+		**s = o;
+		delete k;
+	}
+	delete q;
+	BAVL_delete_unwind(s-1, pstack, b-1);
+	return *this;
+}
+
+
+template <class T, unsigned int B>
+void BAVL<T, B>::print(void) const {
+	if (root) BAVL_print(root);
+	std::cout << std::endl;
+}
+
+
+
+/* Testing main */
+
+#ifndef NO_TESTING_MAIN
+
+#include <cstdlib>
+#include <ctime>
+#include "perf-counters.h"
+using namespace std;
+
+
+int main(int argc, char **argv)
+{
+	int i, j, n;
+	double t;
+	PERF perf;
+	BAVL<int> tree;
+	if (argc > 3) return EXIT_FAILURE;
+	i = time(0);
+	if (argc == 1) n = 20;
+	else {
+		n = atoi(argv[1]);
+		if (argc == 3) i = atoi(argv[2]);
+	}
+	srand((unsigned int)i);
+	cout << "Size is " << n << endl;
+	cout << "Seed is " << i << endl;
+	cout << "Inserting..." << endl;
+	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
+	for (i = 1 ; i <= n ; i++) {
+		j = rand()%n+1;
+	//	cout << j << ' ';
+		tree.insert(j);
+	}
+	perf.stop();
+	t = ((double)clock())/CLOCKS_PER_SEC-t;
+	cout << t << " secs" << endl;
+	perf.report(n);
+//	cout << "\nPrinting tree..." << endl;
+//	tree.print();
+	cout << "Size of tree is: " << tree.size() << endl;
+	cout << "Nodes in tree: " << tree.nodes() << endl;
+	cout << "Extracting..." << endl;
+	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
+	for (i = 1 ; i <= n ; i++) {
+		j = rand()%n+1;
+	//	cout << j << ' ';
+		tree.extract(j);
+	}
+	perf.stop();
+	t = ((double)clock())/CLOCKS_PER_SEC-t;
+	cout << t << " secs" << endl;
+	perf.report(n);
+//	cout << "\nPrinting tree..." << endl;
+//	tree.print();
+	cout << "Size of tree is: " << tree.size() << endl;
+	cout << "Nodes in tree: " << tree.nodes() << endl;
+	cout << "Clearing..." << endl;
+	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
+	tree.clear();
+	perf.stop();
+	t = ((double)clock())/CLOCKS_PER_SEC-t;
+	cout << t << " secs" << endl;
+	perf.report(n);
+	return EXIT_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,397 @@
+/*
+ * C++ Compressed read-only index of integer keys
+ * Written by orestisp
+ * std06176@di.uoa.gr
+ */
+
+
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <utility>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "parallel-traversal.h"
+
+
+/*
+ * A frozen set of integer keys of up to 32 bits, for key sets that are
+ * only queried. The sorted keys are cut in blocks of 128; a block keeps
+ * its first key in a separate array of heads, searched first, and every
+ * key as its distance to the one before, less one, packed in the fewest
+ * bits that hold the largest. The 128 values are stored in 4 lanes of
+ * 32 (key i in lane i%4), so one 128 bit load unpacks 4 keys with SSE2
+ * and a prefix sum turns the distances back into keys. Keys are kept as
+ * ints with unsigned types shifted by 2^31, so that order is preserved.
+ */
+
+template <class T = int>
+class CI {
+	private:
+		enum { BLOCK = 128 };
+		std::vector<int> heads;
+		std::vector<unsigned int> offsets;
+		std::vector<unsigned int> words;
+		unsigned long long size_var;
+		static inline int CI_map(const T&);
+		static inline T CI_unmap(int);
+		unsigned int CI_count(unsigned long long) const;
+		void CI_pack(const int*, unsigned int);
+		template <class F> inline void CI_scan(unsigned long long, F&) const;
+		unsigned long long CI_rank(int, bool) const;
+	public:
+		CI(void);
+		template <class I> CI(I, I, unsigned int = 0);
+		CI<T>& swap(CI&);
+		bool empty(void) const;
+		unsigned long long size(void) const;
+		CI<T>& clear(void);
+		template <class I> CI<T>& build(I, I, unsigned int = 0);
+		bool find(const T&) const;
+		unsigned long long count_range(const T&, const T&) const;
+		template <class F> void for_each_range(const T&, const T&, F) const;
+		template <class F> void for_each(F) const;
+		unsigned long long memory(void) const;
+};
+
+
+template <class T>
+inline int CI<T>::CI_map(const T& d) {
+	if (std::numeric_limits<T>::is_signed) return (int)d;
+	return (int)((unsigned int)d ^ 0x80000000u);
+}
+
+
+template <class T>
+inline T CI<T>::CI_unmap(int m) {
+	if (std::numeric_limits<T>::is_signed) return (T)m;
+	return (T)((unsigned int)m ^ 0x80000000u);
+}
+
+
+template <class T>
+unsigned int CI<T>::CI_count(unsigned long long b) const {
+	return b+1 < heads.size() ? (unsigned int)BLOCK : size_var-b*BLOCK;
+}
+
+
+/* Appends a block of n keys, n <= BLOCK, the missing ones packed as 0 */
+template <class T>
+void CI<T>::CI_pack(const int* a, unsigned int n) {
+	unsigned int d[BLOCK] = {0}, o = 0, w = 0;
+	size_t base = words.size();
+	for (unsigned int i = 1 ; i < n ; i++)
+		o |= d[i] = (unsigned int)a[i]-(unsigned int)a[i-1]-1;
+	while (w < 32 && o >> w) w++;
+	heads.push_back(a[0]);
+	offsets.push_back(offsets.back()+w);
+	words.resize(base+4*w, 0);
+	for (unsigned int l = 0 ; w && l < 4 ; l++)
+		for (unsigned int j = 0, p = 0 ; j < BLOCK/4 ; j++, p += w) {
+			unsigned long long v = (unsigned long long)d[4*j+l] << (p & 31);
+			words[base+4*(p >> 5)+l] |= (unsigned int)v;
+			if ((p & 31)+w > 32) words[base+4*((p >> 5)+1)+l] |= (unsigned int)(v >> 32);
+		}
+}
+
+
+/*
+ * Unpacks block b four keys at a time and calls f(keys, c) with the c
+ * of them that are in the block, as mapped ints, until f returns false.
+ */
+template <class T>
+template <class F>
+inline void CI<T>::CI_scan(unsigned long long b, F& f) const {
+	const unsigned int *p = words.data()+(size_t)offsets[b]*4;
+	unsigned int w = offsets[b+1]-offsets[b], n = CI_count(b), s = 0;
+#ifdef __SSE2__
+	alignas(16) int k[4];
+	__m128i cur = _mm_setzero_si128(), d;
+	__m128i mask = _mm_set1_epi32(w == 32 ? -1 : (int)((1u << w)-1));
+	__m128i one = _mm_set1_epi32(1);
+	__m128i last = _mm_set1_epi32((int)((unsigned int)heads[b]-1));
+	for (unsigned int j = 0 ; j < n ; j += 4) {
+		if (!w) d = _mm_setzero_si128();
+		else {
+			if (!s) cur = _mm_loadu_si128((const __m128i*)p);
+			d = _mm_srl_epi32(cur, _mm_cvtsi32_si128(s));
+			s += w;
+			if (s >= 32) {
+				s -= 32;
+				p += 4;
+				if (s) {
+					cur = _mm_loadu_si128((const __m128i*)p);
+					d = _mm_or_si128(d, _mm_sll_epi32(cur, _mm_cvtsi32_si128(w-s)));
+				}
+			}
+			d = _mm_and_si128(d, mask);
+		}
+		d = _mm_add_epi32(d, one);
+		d = _mm_add_epi32(d, _mm_slli_si128(d, 4));
+		d = _mm_add_epi32(d, _mm_slli_si128(d, 8));
+		d = _mm_add_epi32(d, last);
+		last = _mm_shuffle_epi32(d, 0xff);
+		_mm_store_si128((__m128i*)k, d);
+		if (!f(k, n-j < 4 ? n-j : 4)) return;
+	}
+#else
+	int k[4];
+	unsigned int last = (unsigned int)heads[b]-1, mask = w == 32 ? ~0u : (1u << w)-1;
+	for (unsigned int j = 0 ; j < n ; j += 4, s += w) {
+		for (unsigned int l = 0 ; l < 4 ; l++) {
+			unsigned int v = 0;
+			if (w) {
+				v = p[4*(s >> 5)+l] >> (s & 31);
+				if ((s & 31)+w > 32) v |= p[4*((s >> 5)+1)+l] << (32-(s & 31));
+			}
+			k[l] = (int)(last += (v & mask)+1);
+		}
+		if (!f(k, n-j < 4 ? n-j : 4)) return;
+	}
+#endif
+}
+
+
+/* The number of keys below m, or up to m if incl */
+template <class T>
+unsigned long long CI<T>::CI_rank(int m, bool incl) const {
+	unsigned long long b, r;
+	std::vector<int>::const_iterator i = incl ?
+		std::upper_bound(heads.begin(), heads.end(), m) :
+		std::lower_bound(heads.begin(), heads.end(), m);
+	if (i == heads.begin()) return 0;
+	b = i-heads.begin()-1;
+	r = b*BLOCK;
+	auto f = [&](const int* k, unsigned int c) {
+		for (unsigned int l = 0 ; l < c ; l++)
+			if (k[l] < m || (incl && k[l] == m)) r++;
+			else return false;
+		return true;
+	};
+	CI_scan(b, f);
+	return r;
+}
+
+
+template <class T>
+CI<T>::CI(void):
+	offsets(1, 0), size_var(0) {
+	static_assert(std::numeric_limits<T>::is_integer && sizeof(T) <= 4,
+	              "CI keeps integer keys of up to 32 bits");
+}
+
+
+/* Keys in any order; duplicates are dropped */
+template <class T>
+template <class I>
+CI<T>::CI(I first, I last, unsigned int threads):
+	offsets(1, 0), size_var(0) {
+	static_assert(std::numeric_limits<T>::is_integer && sizeof(T) <= 4,
+	              "CI keeps integer keys of up to 32 bits");
+	build(first, last, threads);
+}
+
+
+template <class T>
+CI<T>& CI<T>::swap(CI& param) {
+	heads.swap(param.heads);
+	offsets.swap(param.offsets);
+	words.swap(param.words);
+	std::swap(size_var, param.size_var);
+	return *this;
+}
+
+
+template <class T>
+bool CI<T>::empty(void) const {
+	return !size_var;
+}
+
+
+template <class T>
+unsigned long long CI<T>::size(void) const {
+	return size_var;
+}
+
+
+template <class T>
+CI<T>& CI<T>::clear(void) {
+	CI<T> t;
+	return swap(t);
+}
+
+
+/* Replaces the keys with those in [first, last), sorted on up to threads threads */
+template <class T>
+template <class I>
+CI<T>& CI<T>::build(I first, I last, unsigned int threads) {
+	std::vector<int> v;
+	CI<T> t;
+	for (; first != last ; ++first)
+		v.push_back(CI_map(*first));
+	PAR_sort_unique(v, threads);
+	t.heads.reserve((v.size()+BLOCK-1)/BLOCK);
+	t.offsets.reserve(t.heads.capacity()+1);
+	for (size_t i = 0 ; i < v.size() ; i += BLOCK)
+		t.CI_pack(&v[i], v.size()-i < BLOCK ? v.size()-i : (size_t)BLOCK);
+	t.size_var = v.size();
+	t.words.shrink_to_fit();
+	return swap(t);
+}
+
+
+/* The heads pick the block, which is unpacked only up to the key */
+template <class T>
+bool CI<T>::find(const T& d) const {
+	int m = CI_map(d);
+	bool r = false;
+	std::vector<int>::const_iterator i = std::upper_bound(heads.begin(), heads.end(), m);
+	if (i == heads.begin()) return false;
+	auto f = [&](const int* k, unsigned int c) {
+		for (unsigned int l = 0 ; l < c ; l++)
+			if (k[l] >= m) {
+				r = k[l] == m;
+				return false;
+			}
+		return true;
+	};
+	CI_scan(i-heads.begin()-1, f);
+	return r;
+}
+
+
+/* Only the blocks of lo and hi are unpacked */
+template <class T>
+unsigned long long CI<T>::count_range(const T& lo, const T& hi) const {
+	if (CI_map(hi) < CI_map(lo)) return 0;
+	return CI_rank(CI_map(hi), true)-CI_rank(CI_map(lo), false);
+}
+
+
+/* Calls f on the keys from lo to hi in order */
+template <class T>
+template <class F>
+void CI<T>::for_each_range(const T& lo, const T& hi, F f) const {
+	int l = CI_map(lo), h = CI_map(hi);
+	bool more = true;
+	unsigned long long b;
+	std::vector<int>::const_iterator i = std::upper_bound(heads.begin(), heads.end(), l);
+	auto g = [&](const int* k, unsigned int c) {
+		for (unsigned int j = 0 ; j < c ; j++)
+			if (k[j] > h) return more = false;
+			else if (k[j] >= l) f(CI_unmap(k[j]));
+		return true;
+	};
+	if (h < l) return;
+	for (b = i == heads.begin() ? 0 : i-heads.begin()-1 ; more && b < heads.size() ; b++)
+		CI_scan(b, g);
+}
+
+
+template <class T>
+template <class F>
+void CI<T>::for_each(F f) const {
+	auto g = [&](const int* k, unsigned int c) {
+		for (unsigned int j = 0 ; j < c ; j++)
+			f(CI_unmap(k[j]));
+		return true;
+	};
+	for (unsigned long long b = 0 ; b < heads.size() ; b++)
+		CI_scan(b, g);
+}
+
+
+/* Bytes taken by the heads, offsets and packed blocks */
+template <class T>
+unsigned long long CI<T>::memory(void) const {
+	return (unsigned long long)heads.capacity()*sizeof(int)+
+	       offsets.capacity()*sizeof(unsigned int)+words.capacity()*sizeof(unsigned int);
+}
+
+
+
+/* Testing main */
+
+#ifndef NO_TESTING_MAIN
+
+#define NO_TESTING_MAIN
+#include "iterative-avl-tree.cpp"
+#include <cstdlib>
+#include <ctime>
+#include "perf-counters.h"
+using namespace std;
+
+
+int main(int argc, char **argv)
+{
+	int i, j, n;
+	double t;
+	PERF perf;
+	AVL<int> tree;
+	vector<int> keys;
+	CI<int> index;
+	if (argc > 3) return EXIT_FAILURE;
+	i = time(0);
+	if (argc == 1) n = 20;
+	else {
+		n = atoi(argv[1]);
+		if (argc == 3) i = atoi(argv[2]);
+	}
+	srand((unsigned int)i);
+	cout << "Size is " << n << endl;
+	cout << "Seed is " << i << endl;
+	cout << "Inserting..." << endl;
+	for (i = 1 ; i <= n ; i++)
+		tree.insert(rand()%(4*n)+1);
+	cout << "Size of tree is: " << tree.size() << endl;
+	cout << "Building index..." << endl;
+	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
+	tree.for_each([&](int d) { keys.push_back(d); });
+	index.build(keys.begin(), keys.end());
+	perf.stop();
+	t = ((double)clock())/CLOCKS_PER_SEC-t;
+	cout << t << " secs" << endl;
+	perf.report(n);
+	cout << "Size of index is: " << index.size() << ", memory: " << index.memory()
+	     << " bytes, " << (double)index.memory()/(index.size() ? index.size() : 1)
+	     << " per key" << endl;
+	for (int k = 0 ; k < 2 ; k++) {
+		cout << (k ? "Looking up in index..." : "Looking up in tree...") << endl;
+		t = ((double)clock())/CLOCKS_PER_SEC;
+		perf.start();
+		for (i = j = 0 ; i < n ; i++)
+			j += k ? index.find(rand()%(4*n)+1) : tree.find(rand()%(4*n)+1);
+		perf.stop();
+		t = ((double)clock())/CLOCKS_PER_SEC-t;
+		cout << t << " secs, " << j << " found" << endl;
+		perf.report(n);
+	}
+	cout << "Counting ranges..." << endl;
+	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
+	unsigned long long c = 0;
+	for (i = 0 ; i < n ; i++) {
+		j = rand()%(4*n)+1;
+		c += index.count_range(j, j+100);
+	}
+	perf.stop();
+	t = ((double)clock())/CLOCKS_PER_SEC-t;
+	cout << t << " secs, " << c << " keys" << endl;
+	perf.report(n);
+	cout << "Scanning..." << endl;
+	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
+	long long s = 0;
+	index.for_each_range(0, 4*n, [&](int d) { s += d; });
+	perf.stop();
+	t = ((double)clock())/CLOCKS_PER_SEC-t;
+	cout << t << " secs, sum is " << s << endl;
+	perf.report(n);
+	return EXIT_SUCCESS;
+}
+
+#endif
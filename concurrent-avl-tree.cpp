@@ -0,0 +1,854 @@
+/*
+ * C++ Concurrent AVL Tree implementation
+ * Written by orestisp
+ * std06176@di.uoa.gr
+ */
+
+
+
+#include <iostream>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <thread>
+
+
+/*
+ * Optimistic concurrent AVL tree, after Bronson, Casper, Chafi and
+ * Olukotun, "A Practical Concurrent Binary Search Tree".
+ *
+ * Readers take no locks. Every node has a version that a rotation bumps
+ * on the nodes it moves down (whose key range shrinks); a reader records
+ * the version of each node it passes and retries from the parent when it
+ * changed. Writers lock the parent of the node they link or unlink, and
+ * rebalancing locks only the parent, node and children of a rotation,
+ * always top down. Removing a key with two children only clears its
+ * present flag; such routing nodes are unlinked by rebalancing once they
+ * have a free child. Unlinked nodes are freed through epochs once no
+ * operation that started before the unlink is still running.
+ *
+ * find, insert and extract may run concurrently; clear, print and the
+ * destructor may not. T must be default constructible.
+ *
+ * Every thread that uses a tree keeps an epoch slot until it exits. The
+ * first SLOTS threads alive at once get one each; any more share one
+ * more slot behind a mutex, which holds the epoch of the oldest of their
+ * operations, so they work but contend and delay reclamation.
+ */
+
+template <int I = 0>
+struct CAVL_epochs {
+	enum { SLOTS = 128, SHARED = SLOTS };
+	static const unsigned long IDLE = 0;
+	struct slot {
+		std::atomic<unsigned long> epoch;
+		std::atomic<bool> used;
+		char pad[64-sizeof(std::atomic<unsigned long>)-sizeof(std::atomic<bool>)];
+	};
+	struct owner {
+		unsigned int i;
+		owner(void) {
+			for (i = 0 ; i < SLOTS ; i++) {
+				bool f = false;
+				if (!slots[i].used.load() && slots[i].used.compare_exchange_strong(f, true))
+					break;
+			}
+		}
+		~owner(void) {
+			if (i != SHARED) slots[i].used.store(false);
+		}
+	};
+	struct guard {
+		unsigned int i;
+		guard(void):
+			i(self()) {
+			if (i != SHARED) slots[i].epoch.store(global.load());
+			else {
+				std::lock_guard<std::mutex> l(shared_lock);
+				if (!shared_users++) slots[i].epoch.store(global.load());
+			}
+		}
+		~guard(void) {
+			if (i != SHARED) slots[i].epoch.store(IDLE, std::memory_order_release);
+			else {
+				std::lock_guard<std::mutex> l(shared_lock);
+				if (!--shared_users) slots[i].epoch.store(IDLE, std::memory_order_release);
+			}
+		}
+	};
+	static slot slots[SLOTS+1];
+	static std::mutex shared_lock;
+	static unsigned long shared_users;
+	static std::atomic<unsigned long> global;
+	static unsigned int self(void) {
+		thread_local owner o;
+		return o.i;
+	}
+	static unsigned long oldest(void) {
+		unsigned long e, m = ~0UL;
+		for (unsigned int i = 0 ; i <= SLOTS ; i++)
+			if ((e = slots[i].epoch.load()) != IDLE && e < m) m = e;
+		return m;
+	}
+};
+
+/* a template only so that its statics can be defined in this file */
+template <int I> typename CAVL_epochs<I>::slot CAVL_epochs<I>::slots[SLOTS+1];
+template <int I> std::mutex CAVL_epochs<I>::shared_lock;
+template <int I> unsigned long CAVL_epochs<I>::shared_users = 0;
+template <int I> std::atomic<unsigned long> CAVL_epochs<I>::global(1);
+typedef CAVL_epochs<> CAVL_epoch;
+
+
+template <class T>
+class CAVL {
+	private:
+		enum { RETRY = -1, ABSENT = 0, PRESENT = 1 };
+		enum { NOTHING = -1, UNLINK = -2, REBALANCE = -3 };
+		enum { UNLINKED = 1, CHANGING = 2, BUMP = 4 };
+		enum { RETIRE_BATCH = 256 };
+		struct node {
+			const T data;
+			std::atomic<long> version;
+			std::atomic<int> height;
+			std::atomic<bool> present;
+			std::atomic_flag busy;
+			std::atomic<node*> parent;
+			std::atomic<node*> left;
+			std::atomic<node*> right;
+			node(const T& d, int h, node* p):
+				data(d), version(0), height(h), present(true),
+				parent(p), left(0), right(0) {
+				busy.clear();
+			}
+			node* child(int dir) const { return dir < 0 ? left.load() : right.load(); }
+			void lock(void) {
+				for (unsigned int i = 0 ; busy.test_and_set(std::memory_order_acquire) ; i++)
+					if (i >= 64) std::this_thread::yield();
+			}
+			void unlock(void) { busy.clear(std::memory_order_release); }
+		};
+		struct counter {
+			std::atomic<long> n;
+			char pad[64-sizeof(std::atomic<long>)];
+		};
+		node *holder;
+		counter count[CAVL_epoch::SLOTS+1];
+		std::mutex retired_lock;
+		std::vector<std::pair<node*, unsigned long> > retired;
+		std::atomic<size_t> retired_size;
+		std::atomic<size_t> reclaim_at;
+		CAVL(const CAVL&);
+		static int CAVL_compare(const T& d, const T& k) { return d < k ? -1 : k < d; }
+		static int CAVL_height(node* p) { return p ? p->height.load(std::memory_order_relaxed) : 0; }
+		static void CAVL_wait(node*, long);
+		void CAVL_count(long);
+		void CAVL_retire(node*);
+		void CAVL_reclaim(void);
+		void CAVL_clear(node*);
+		void CAVL_print(node*) const;
+		int CAVL_get(const T&, node*, int, long) const;
+		int CAVL_put(const T&, node*, int, long);
+		int CAVL_remove(const T&, node*, int, long);
+		int CAVL_remove_node(node*, node*);
+		static bool CAVL_unlink(node*, node*);
+		static int CAVL_condition(node*);
+		void CAVL_fix(node*);
+		static node* CAVL_fix_height(node*);
+		static node* CAVL_rebalance(node*, node*, node*&);
+		static node* CAVL_rebalance_right(node*, node*, node*, int, node*&);
+		static node* CAVL_rebalance_left(node*, node*, node*, int, node*&);
+		static node* CAVL_rotate_right(node*, node*, node*, int, int, node*, int);
+		static node* CAVL_rotate_left(node*, node*, int, node*, node*, int, int);
+		static node* CAVL_rotate_right_over_left(node*, node*, node*, int, int, node*, int, node*&);
+		static node* CAVL_rotate_left_over_right(node*, node*, int, node*, node*, int, int, node*&);
+	public:
+		CAVL(void);
+		~CAVL(void);
+		bool empty(void) const;
+		unsigned int size(void) const;
+		CAVL<T>& clear(void);
+		bool find(const T&) const;
+		CAVL<T>& insert(const T&);
+		CAVL<T>& extract(const T&);
+		void print(void) const;
+};
+
+
+template <class T>
+void CAVL<T>::CAVL_wait(node* p, long v) {
+	if (!(v & CHANGING)) return;
+	for (unsigned int i = 0 ; p->version.load() == v ; i++)
+		if (i >= 64) std::this_thread::yield();
+}
+
+
+template <class T>
+void CAVL<T>::CAVL_count(long d) {
+	count[CAVL_epoch::self()].n.fetch_add(d, std::memory_order_relaxed);
+}
+
+
+template <class T>
+void CAVL<T>::CAVL_retire(node* p) {
+	std::lock_guard<std::mutex> g(retired_lock);
+	retired.push_back(std::make_pair(p, CAVL_epoch::global.load()));
+	retired_size.store(retired.size(), std::memory_order_relaxed);
+}
+
+
+/* Called outside of any guard, so the caller does not hold back its own retirees */
+template <class T>
+void CAVL<T>::CAVL_reclaim(void) {
+	std::vector<node*> v;
+	if (retired_size.load(std::memory_order_relaxed) < reclaim_at.load(std::memory_order_relaxed))
+		return;
+	{
+		std::lock_guard<std::mutex> g(retired_lock);
+		if (retired.size() < reclaim_at.load()) return;
+		CAVL_epoch::global.fetch_add(1);
+		unsigned long m = CAVL_epoch::oldest();
+		unsigned int i, j = 0;
+		for (i = 0 ; i < retired.size() ; i++)
+			if (retired[i].second < m) v.push_back(retired[i].first);
+			else retired[j++] = retired[i];
+		retired.resize(j);
+		retired_size.store(j, std::memory_order_relaxed);
+		reclaim_at.store(j+RETIRE_BATCH, std::memory_order_relaxed);
+	}
+	for (unsigned int i = 0 ; i < v.size() ; i++)
+		delete v[i];
+}
+
+
+template <class T>
+void CAVL<T>::CAVL_clear(node* p) {
+	if (p->left.load()) CAVL_clear(p->left.load());
+	if (p->right.load()) CAVL_clear(p->right.load());
+	delete p;
+}
+
+
+template <class T>
+void CAVL<T>::CAVL_print(node* p) const {
+	if (p->left.load()) CAVL_print(p->left.load());
+	if (p->present.load()) std::cout << p->data << ' ';
+	if (p->right.load()) CAVL_print(p->right.load());
+}
+
+
+template <class T>
+int CAVL<T>::CAVL_get(const T& d, node* p, int dir, long v) const {
+	for (;;) {
+		node *c = p->child(dir);
+		if (p->version.load() != v) return RETRY;
+		if (!c) return ABSENT;
+		int nd = CAVL_compare(d, c->data);
+		if (!nd) return c->present.load() ? PRESENT : ABSENT;
+		long cv = c->version.load();
+		if (cv & (CHANGING | UNLINKED))
+			CAVL_wait(c, cv);
+		else if (c == p->child(dir)) {
+			if (p->version.load() != v) return RETRY;
+			int r = CAVL_get(d, c, nd, cv);
+			if (r != RETRY) return r;
+		}
+	}
+}
+
+
+template <class T>
+int CAVL<T>::CAVL_put(const T& d, node* p, int dir, long v) {
+	for (;;) {
+		node *c = p->child(dir);
+		if (p->version.load() != v) return RETRY;
+		if (!c) {
+			node *k = new node(d, 1, p);
+			p->lock();
+			if (p->version.load() != v) {
+				p->unlock();
+				delete k;
+				return RETRY;
+			}
+			if (p->child(dir)) {
+				p->unlock();
+				delete k;
+				continue;
+			}
+			if (dir < 0) p->left.store(k);
+			else p->right.store(k);
+			p->unlock();
+			CAVL_count(1);
+			CAVL_fix(p);
+			return PRESENT;
+		}
+		int nd = CAVL_compare(d, c->data);
+		if (!nd) {
+			if (c->present.load()) return ABSENT;
+			c->lock();
+			if (c->version.load() & UNLINKED) {
+				c->unlock();
+				continue;
+			}
+			bool was = c->present.exchange(true);
+			c->unlock();
+			if (was) return ABSENT;
+			CAVL_count(1);
+			return PRESENT;
+		}
+		long cv = c->version.load();
+		if (cv & (CHANGING | UNLINKED))
+			CAVL_wait(c, cv);
+		else if (c == p->child(dir)) {
+			if (p->version.load() != v) return RETRY;
+			int r = CAVL_put(d, c, nd, cv);
+			if (r != RETRY) return r;
+		}
+	}
+}
+
+
+template <class T>
+int CAVL<T>::CAVL_remove(const T& d, node* p, int dir, long v) {
+	for (;;) {
+		node *c = p->child(dir);
+		if (p->version.load() != v) return RETRY;
+		if (!c) return ABSENT;
+		int nd = CAVL_compare(d, c->data);
+		if (!nd) {
+			int r = CAVL_remove_node(p, c);
+			if (r != RETRY) return r;
+			continue;
+		}
+		long cv = c->version.load();
+		if (cv & (CHANGING | UNLINKED))
+			CAVL_wait(c, cv);
+		else if (c == p->child(dir)) {
+			if (p->version.load() != v) return RETRY;
+			int r = CAVL_remove(d, c, nd, cv);
+			if (r != RETRY) return r;
+		}
+	}
+}
+
+
+template <class T>
+int CAVL<T>::CAVL_remove_node(node* p, node* c) {
+	if (!c->present.load()) return ABSENT;
+	if (!c->left.load() || !c->right.load()) {
+		p->lock();
+		if ((p->version.load() & UNLINKED) || c->parent.load() != p) {
+			p->unlock();
+			return RETRY;
+		}
+		c->lock();
+		if (!c->present.load()) {
+			c->unlock();
+			p->unlock();
+			return ABSENT;
+		}
+		if (!CAVL_unlink(p, c)) {
+			c->unlock();
+			p->unlock();
+			return RETRY;
+		}
+		c->unlock();
+		p->unlock();
+		CAVL_count(-1);
+		CAVL_fix(p);
+		CAVL_retire(c);
+		return PRESENT;
+	}
+	c->lock();
+	if (c->version.load() & UNLINKED) {
+		c->unlock();
+		return RETRY;
+	}
+	bool was = c->present.exchange(false);
+	c->unlock();
+	if (!was) return ABSENT;
+	CAVL_count(-1);
+	if (!c->left.load() || !c->right.load()) CAVL_fix(c);
+	return PRESENT;
+}
+
+
+/* Called with p and c locked; splices out c if it has at most one child */
+template <class T>
+bool CAVL<T>::CAVL_unlink(node* p, node* c) {
+	node *pl = p->left.load(), *pr = p->right.load();
+	if (pl != c && pr != c) return false;
+	node *l = c->left.load(), *r = c->right.load();
+	if (l && r) return false;
+	node *s = l ? l : r;
+	if (pl == c) p->left.store(s);
+	else p->right.store(s);
+	if (s) s->parent.store(p);
+	c->version.store(UNLINKED);
+	c->present.store(false);
+	return true;
+}
+
+
+template <class T>
+int CAVL<T>::CAVL_condition(node* p) {
+	node *l = p->left.load(), *r = p->right.load();
+	if ((!l || !r) && !p->present.load()) return UNLINK;
+	int h = p->height.load(), hl = CAVL_height(l), hr = CAVL_height(r);
+	int hn = 1+(hl > hr ? hl : hr), b = hl-hr;
+	if (b < -1 || b > 1) return REBALANCE;
+	return h != hn ? hn : NOTHING;
+}
+
+
+/*
+ * Walks up from p fixing heights, rebalancing and unlinking routing nodes.
+ * A rotation may hand back a damaged node below the parent it had locked
+ * without fixing that parent's height, so such parents are kept in up[]
+ * and revisited once the damage below them is repaired.
+ */
+template <class T>
+void CAVL<T>::CAVL_fix(node* p) {
+	node *up[64];
+	unsigned int ups = 0;
+	for (;;) {
+		int c = NOTHING;
+		if (p && p->parent.load() && !(p->version.load() & UNLINKED))
+			c = CAVL_condition(p);
+		if (c == NOTHING) {
+			if (!ups) return;
+			p = up[--ups];
+		} else if (c != UNLINK && c != REBALANCE) {
+			p->lock();
+			node *n = CAVL_fix_height(p);
+			p->unlock();
+			p = n;
+		} else {
+			node *q = p->parent.load(), *dead = 0;
+			q->lock();
+			if (!(q->version.load() & UNLINKED) && p->parent.load() == q) {
+				p->lock();
+				node *n = CAVL_rebalance(q, p, dead);
+				p->unlock();
+				if (n && n != q && n != q->parent.load() &&
+				    (!ups || up[ups-1] != q) && ups < 64)
+					up[ups++] = q;
+				p = n;
+			}
+			q->unlock();
+			if (dead) CAVL_retire(dead);
+		}
+	}
+}
+
+
+template <class T>
+typename CAVL<T>::node* CAVL<T>::CAVL_fix_height(node* p) {
+	int c = CAVL_condition(p);
+	if (c == REBALANCE || c == UNLINK) return p;
+	if (c == NOTHING) return 0;
+	p->height.store(c);
+	return p->parent.load();
+}
+
+
+template <class T>
+typename CAVL<T>::node* CAVL<T>::CAVL_rebalance(node* q, node* p, node*& dead) {
+	node *l = p->left.load(), *r = p->right.load();
+	if ((!l || !r) && !p->present.load()) {
+		if (!CAVL_unlink(q, p)) return p;
+		dead = p;
+		return CAVL_fix_height(q);
+	}
+	int h = p->height.load(), hl = CAVL_height(l), hr = CAVL_height(r);
+	int hn = 1+(hl > hr ? hl : hr), b = hl-hr;
+	if (b > 1) return CAVL_rebalance_right(q, p, l, hr, dead);
+	if (b < -1) return CAVL_rebalance_left(q, p, r, hl, dead);
+	if (hn != h) {
+		p->height.store(hn);
+		return CAVL_fix_height(q);
+	}
+	return 0;
+}
+
+
+template <class T>
+typename CAVL<T>::node* CAVL<T>::CAVL_rebalance_right(node* q, node* p, node* l, int hr, node*& dead) {
+	node *n;
+	l->lock();
+	int hl = l->height.load();
+	if (hl-hr <= 1) {
+		l->unlock();
+		return p;
+	}
+	node *lr = l->right.load();
+	int hll = CAVL_height(l->left.load()), hlr = CAVL_height(lr);
+	if (hll >= hlr) {
+		n = CAVL_rotate_right(q, p, l, hr, hll, lr, hlr);
+		l->unlock();
+		return n;
+	}
+	lr->lock();
+	hlr = lr->height.load();
+	if (hll >= hlr) {
+		n = CAVL_rotate_right(q, p, l, hr, hll, lr, hlr);
+		lr->unlock();
+		l->unlock();
+		return n;
+	}
+	int hlrl = CAVL_height(lr->left.load()), b = hll-hlrl;
+	if (b >= -1 && b <= 1) {
+		n = CAVL_rotate_right_over_left(q, p, l, hr, hll, lr, hlrl, dead);
+		lr->unlock();
+		l->unlock();
+		return n;
+	}
+	lr->unlock();
+	n = CAVL_rebalance_left(p, l, lr, hll, dead);
+	l->unlock();
+	return n;
+}
+
+
+template <class T>
+typename CAVL<T>::node* CAVL<T>::CAVL_rebalance_left(node* q, node* p, node* r, int hl, node*& dead) {
+	node *n;
+	r->lock();
+	int hr = r->height.load();
+	if (hl-hr >= -1) {
+		r->unlock();
+		return p;
+	}
+	node *rl = r->left.load();
+	int hrl = CAVL_height(rl), hrr = CAVL_height(r->right.load());
+	if (hrr >= hrl) {
+		n = CAVL_rotate_left(q, p, hl, r, rl, hrl, hrr);
+		r->unlock();
+		return n;
+	}
+	rl->lock();
+	hrl = rl->height.load();
+	if (hrr >= hrl) {
+		n = CAVL_rotate_left(q, p, hl, r, rl, hrl, hrr);
+		rl->unlock();
+		r->unlock();
+		return n;
+	}
+	int hrlr = CAVL_height(rl->right.load()), b = hrr-hrlr;
+	if (b >= -1 && b <= 1) {
+		n = CAVL_rotate_left_over_right(q, p, hl, r, rl, hrr, hrlr, dead);
+		rl->unlock();
+		r->unlock();
+		return n;
+	}
+	rl->unlock();
+	n = CAVL_rebalance_right(p, r, rl, hrr, dead);
+	r->unlock();
+	return n;
+}
+
+
+template <class T>
+typename CAVL<T>::node* CAVL<T>::CAVL_rotate_right(node* q, node* p, node* l, int hr,
+                                                   int hll, node* lr, int hlr) {
+	long v = p->version.load();
+	node *ql = q->left.load();
+	p->version.store(v | CHANGING);
+	p->left.store(lr);
+	if (lr) lr->parent.store(p);
+	l->right.store(p);
+	p->parent.store(l);
+	if (ql == p) q->left.store(l);
+	else q->right.store(l);
+	l->parent.store(q);
+	int hp = 1+(hlr > hr ? hlr : hr);
+	p->height.store(hp);
+	l->height.store(1+(hll > hp ? hll : hp));
+	p->version.store(v+BUMP);
+	int b = hlr-hr;
+	if (b < -1 || b > 1) return p;
+	if ((!lr || hr == 0) && !p->present.load()) return p;
+	b = hll-hp;
+	if (b < -1 || b > 1) return l;
+	if (hll == 0 && !l->present.load()) return l;
+	return CAVL_fix_height(q);
+}
+
+
+template <class T>
+typename CAVL<T>::node* CAVL<T>::CAVL_rotate_left(node* q, node* p, int hl, node* r,
+                                                  node* rl, int hrl, int hrr) {
+	long v = p->version.load();
+	node *ql = q->left.load();
+	p->version.store(v | CHANGING);
+	p->right.store(rl);
+	if (rl) rl->parent.store(p);
+	r->left.store(p);
+	p->parent.store(r);
+	if (ql == p) q->left.store(r);
+	else q->right.store(r);
+	r->parent.store(q);
+	int hp = 1+(hl > hrl ? hl : hrl);
+	p->height.store(hp);
+	r->height.store(1+(hp > hrr ? hp : hrr));
+	p->version.store(v+BUMP);
+	int b = hrl-hl;
+	if (b < -1 || b > 1) return p;
+	if ((!rl || hl == 0) && !p->present.load()) return p;
+	b = hrr-hp;
+	if (b < -1 || b > 1) return r;
+	if (hrr == 0 && !r->present.load()) return r;
+	return CAVL_fix_height(q);
+}
+
+
+template <class T>
+typename CAVL<T>::node* CAVL<T>::CAVL_rotate_right_over_left(node* q, node* p, node* l,
+                                                             int hr, int hll, node* lr, int hlrl,
+                                                             node*& dead) {
+	long v = p->version.load(), lv = l->version.load();
+	node *ql = q->left.load(), *lrl = lr->left.load(), *lrr = lr->right.load();
+	int hlrr = CAVL_height(lrr);
+	p->version.store(v | CHANGING);
+	l->version.store(lv | CHANGING);
+	p->left.store(lrr);
+	if (lrr) lrr->parent.store(p);
+	l->right.store(lrl);
+	if (lrl) lrl->parent.store(l);
+	lr->left.store(l);
+	l->parent.store(lr);
+	lr->right.store(p);
+	p->parent.store(lr);
+	if (ql == p) q->left.store(lr);
+	else q->right.store(lr);
+	lr->parent.store(q);
+	int hp = 1+(hlrr > hr ? hlrr : hr), hln = 1+(hll > hlrl ? hll : hlrl);
+	p->height.store(hp);
+	l->height.store(hln);
+	lr->height.store(1+(hln > hp ? hln : hp));
+	p->version.store(v+BUMP);
+	l->version.store(lv+BUMP);
+	if ((hll == 0 || hlrl == 0) && !l->present.load() && CAVL_unlink(lr, l)) {
+		dead = l;
+		hln--;
+		lr->height.store(1+(hln > hp ? hln : hp));
+	}
+	int b = hlrr-hr;
+	if (b < -1 || b > 1) return p;
+	if ((!lrr || hr == 0) && !p->present.load()) return p;
+	b = hln-hp;
+	if (b < -1 || b > 1) return lr;
+	return CAVL_fix_height(q);
+}
+
+
+template <class T>
+typename CAVL<T>::node* CAVL<T>::CAVL_rotate_left_over_right(node* q, node* p, int hl, node* r,
+                                                             node* rl, int hrr, int hrlr,
+                                                             node*& dead) {
+	long v = p->version.load(), rv = r->version.load();
+	node *ql = q->left.load(), *rll = rl->left.load(), *rlr = rl->right.load();
+	int hrll = CAVL_height(rll);
+	p->version.store(v | CHANGING);
+	r->version.store(rv | CHANGING);
+	p->right.store(rll);
+	if (rll) rll->parent.store(p);
+	r->left.store(rlr);
+	if (rlr) rlr->parent.store(r);
+	rl->right.store(r);
+	r->parent.store(rl);
+	rl->left.store(p);
+	p->parent.store(rl);
+	if (ql == p) q->left.store(rl);
+	else q->right.store(rl);
+	rl->parent.store(q);
+	int hp = 1+(hl > hrll ? hl : hrll), hrn = 1+(hrlr > hrr ? hrlr : hrr);
+	p->height.store(hp);
+	r->height.store(hrn);
+	rl->height.store(1+(hp > hrn ? hp : hrn));
+	p->version.store(v+BUMP);
+	r->version.store(rv+BUMP);
+	if ((hrr == 0 || hrlr == 0) && !r->present.load() && CAVL_unlink(rl, r)) {
+		dead = r;
+		hrn--;
+		rl->height.store(1+(hp > hrn ? hp : hrn));
+	}
+	int b = hrll-hl;
+	if (b < -1 || b > 1) return p;
+	if ((!rll || hl == 0) && !p->present.load()) return p;
+	b = hrn-hp;
+	if (b < -1 || b > 1) return rl;
+	return CAVL_fix_height(q);
+}
+
+
+template <class T>
+CAVL<T>::CAVL(void):
+	holder(0), count(), retired_size(0), reclaim_at(RETIRE_BATCH) {
+	holder = new node(T(), 0, 0);
+	holder->present.store(false);
+}
+
+
+template <class T>
+CAVL<T>::~CAVL(void) {
+	clear();
+	delete holder;
+}
+
+
+template <class T>
+bool CAVL<T>::empty(void) const {
+	return size() == 0;
+}
+
+
+template <class T>
+unsigned int CAVL<T>::size(void) const {
+	long n = 0;
+	for (unsigned int i = 0 ; i <= CAVL_epoch::SLOTS ; i++)
+		n += count[i].n.load(std::memory_order_relaxed);
+	return n;
+}
+
+
+template <class T>
+CAVL<T>& CAVL<T>::clear(void) {
+	if (holder->right.load()) CAVL_clear(holder->right.load());
+	holder->right.store(0);
+	for (unsigned int i = 0 ; i < retired.size() ; i++)
+		delete retired[i].first;
+	retired.clear();
+	retired_size.store(0);
+	reclaim_at.store(RETIRE_BATCH);
+	for (unsigned int i = 0 ; i <= CAVL_epoch::SLOTS ; i++)
+		count[i].n.store(0);
+	return *this;
+}
+
+
+template <class T>
+bool CAVL<T>::find(const T& d) const {
+	CAVL_epoch::guard g;
+	int r;
+	while ((r = CAVL_get(d, holder, 1, holder->version.load())) == RETRY) ;
+	return r == PRESENT;
+}
+
+
+template <class T>
+CAVL<T>& CAVL<T>::insert(const T& d) {
+	{
+		CAVL_epoch::guard g;
+		while (CAVL_put(d, holder, 1, holder->version.load()) == RETRY) ;
+	}
+	CAVL_reclaim();
+	return *this;
+}
+
+
+template <class T>
+CAVL<T>& CAVL<T>::extract(const T& d) {
+	{
+		CAVL_epoch::guard g;
+		while (CAVL_remove(d, holder, 1, holder->version.load()) == RETRY) ;
+	}
+	CAVL_reclaim();
+	return *this;
+}
+
+
+template <class T>
+void CAVL<T>::print(void) const {
+	if (holder->right.load()) CAVL_print(holder->right.load());
+	std::cout << std::endl;
+}
+
+
+
+/* Testing main */
+
+#ifndef NO_TESTING_MAIN
+
+#define NO_TESTING_MAIN
+#include "iterative-avl-tree.cpp"
+#include <cstdlib>
+#include <ctime>
+#include <chrono>
+using namespace std;
+
+
+/* The sequential AVL behind one mutex, the baseline to scale against */
+template <class T>
+class LOCKED {
+	private:
+		AVL<T> tree;
+		mutable mutex m;
+	public:
+		unsigned int size(void) const { lock_guard<mutex> g(m); return tree.size(); }
+		bool find(const T& d) const { lock_guard<mutex> g(m); return tree.find(d); }
+		LOCKED<T>& insert(const T& d) { lock_guard<mutex> g(m); tree.insert(d); return *this; }
+		LOCKED<T>& extract(const T& d) { lock_guard<mutex> g(m); tree.extract(d); return *this; }
+};
+
+
+/* Hits are summed so that the lookups cannot be optimized away */
+template <class S>
+static double run(S& tree, unsigned int threads, unsigned int ops, int reads, int n, int seed) {
+	vector<thread> w;
+	atomic<unsigned int> hits(0);
+	chrono::steady_clock::time_point t = chrono::steady_clock::now();
+	for (unsigned int i = 0 ; i < threads ; i++)
+		w.push_back(thread([&tree, &hits, i, threads, ops, reads, n, seed]() {
+			unsigned int x = seed*2654435761u+i+1, h = 0;
+			for (unsigned int j = 0 ; j < ops/threads ; j++) {
+				x ^= x << 13;
+				x ^= x >> 17;
+				x ^= x << 5;
+				int k = x%n, r = (x >> 16)%100;
+				if (r < reads) h += tree.find(k);
+				else if (r < reads+(100-reads)/2) tree.insert(k);
+				else tree.extract(k);
+			}
+			hits += h;
+		}));
+	for (unsigned int i = 0 ; i < threads ; i++)
+		w[i].join();
+	return chrono::duration<double>(chrono::steady_clock::now()-t).count();
+}
+
+
+int main(int argc, char **argv)
+{
+	int i, n, ratios[] = { 90, 50 };
+	unsigned int threads, ops = 2000000;
+	if (argc > 3) return EXIT_FAILURE;
+	i = time(0);
+	if (argc == 1) n = 1 << 16;
+	else {
+		n = atoi(argv[1]);
+		if (argc == 3) i = atoi(argv[2]);
+	}
+	if (n <= 0) return EXIT_FAILURE;
+	srand((unsigned int)i);
+	cout << "Size is " << n << endl;
+	cout << "Seed is " << i << endl;
+	for (int r = 0 ; r < 2 ; r++)
+		for (threads = 1 ; threads <= 32 ; threads *= 2) {
+			CAVL<int> ctree;
+			LOCKED<int> ltree;
+			for (int j = 0 ; j < n/2 ; j++) {
+				int k = rand()%n;
+				ctree.insert(k);
+				ltree.insert(k);
+			}
+			double ct = run(ctree, threads, ops, ratios[r], n, i);
+			double lt = run(ltree, threads, ops, ratios[r], n, i);
+			cout << ratios[r] << "% reads, " << threads << " threads: "
+			     << ops/ct/1e6 << " Mops/sec concurrent, "
+			     << ops/lt/1e6 << " Mops/sec locked" << endl;
+		}
+	return EXIT_SUCCESS;
+}
+
+#endif
@@ -7,65 +7,243 @@
 
 
 #include <iostream>
+#include <string>
+#include <vector>
+#include <functional>
+#include <new>
+#include <utility>
+#include <atomic>
+#include "bloom-filter.h"
+#include "parallel-traversal.h"
+#include "memory-usage.h"
 
 
+/*
+ * Part of the key kept inline in the node and compared before the key
+ * itself; only a tie (0) falls back to the full comparison. For most
+ * types it is empty and always ties, so it costs nothing.
+ */
+
 template <class T>
-class AVL {
+struct AVL_key {
+	AVL_key(const T&) {}
+	static int compare(const AVL_key&, const AVL_key&) { return 0; }
+};
+
+
+/* The first 8 bytes of a string, big endian and zero padded */
+template <>
+struct AVL_key<std::string> {
+	unsigned long long prefix;
+	AVL_key(const std::string& s):
+		prefix(0) {
+		for (std::string::size_type i = 0 ; i < 8 ; i++)
+			prefix = prefix << 8 | (i < s.size() ? (unsigned char)s[i] : 0);
+	}
+	static int compare(const AVL_key& a, const AVL_key& b) {
+		return a.prefix < b.prefix ? -1 : a.prefix > b.prefix;
+	}
+};
+
+
+/*
+ * Room inside the tree object for its first N keys, kept sorted, so that
+ * small trees need no heap at all. With N = 0 it is empty and takes no
+ * space in the tree.
+ */
+
+template <class T, unsigned int N>
+struct AVL_small {
+	alignas(T) unsigned char mem[N*sizeof(T)];
+	T* keys(void) { return reinterpret_cast<T*>(mem); }
+	const T* keys(void) const { return reinterpret_cast<const T*>(mem); }
+};
+
+
+template <class T>
+struct AVL_small<T, 0> {
+	T* keys(void) { return 0; }
+	const T* keys(void) const { return 0; }
+};
+
+
+template <class T, unsigned int N = 0>
+class AVL: private AVL_small<T, N> {
 	private:
-		struct node {
+		struct node: AVL_key<T> {
 			T data;
 			int balance:2;
 			node *left;
 			node *right;
 			node(const T& d, int b = 0):
-				data(d), balance(b), left(0), right(0) {}
+				AVL_key<T>(d), data(d), balance(b), left(0), right(0) {}
 		};
+		struct region {
+			node *base;
+			unsigned int size;
+			unsigned int cap;
+			unsigned int live;
+			node *spare;
+		};
+		struct spine {
+			std::vector<node**> v;
+			unsigned int n;
+			spine(void): n(0) {}
+		};
+		struct alignas(64) cache_set {
+			std::atomic<node*> p[4];
+			std::atomic<unsigned int> tag[4];
+			node* at(unsigned int i) const { return p[i].load(std::memory_order_relaxed); }
+			void put(unsigned int i, node* q, unsigned int t) {
+				p[i].store(q, std::memory_order_relaxed);
+				tag[i].store(t, std::memory_order_relaxed);
+			}
+			void copy(unsigned int i, unsigned int j) { put(i, at(j), tag[j].load(std::memory_order_relaxed)); }
+			void clear(void) { for (unsigned int i = 0 ; i < 4 ; i++) put(i, 0, 0); }
+		};
+		enum { STACK = sizeof(unsigned int)*12 };
 		node *root;
-		node ***pstack;
-		bool *dstack;
+		node *lmost;
+		node *rmost;
+		spine lspine;
+		spine rspine;
 		unsigned int size_var;
+		unsigned long long rotations_var;
+		std::vector<region> regions;
+		T *cursor;
+		bool compacting;
+		BLOOM<T> filter;
+		unsigned int filter_stale;
+		mutable std::atomic<unsigned long long> filter_rejects;
+		mutable std::atomic<unsigned long long> filter_false;
+		mutable std::vector<cache_set> cache;
+		mutable std::atomic<unsigned long long> cache_hits;
+		mutable std::atomic<unsigned long long> cache_misses;
+		unsigned long long limit_var;
 		inline void AVL_LL_rotate(node**);
 		inline void AVL_RR_rotate(node**);
 		inline void AVL_LR_rotate(node**);
 		inline void AVL_RL_rotate(node**);
+		inline unsigned int AVL_unwind(node***, node***, bool*);
+		void AVL_ends(void);
+		void AVL_spines(const bool*, unsigned int);
+		unsigned int AVL_region(node*) const;
+		void AVL_add_region(unsigned int);
+		node* AVL_new(const T&);
+		void AVL_free(node*);
+		void AVL_move(node**);
+		void AVL_evacuate(void);
+		unsigned int AVL_clear(node*);
+		bool AVL_insert(const T&, node*);
+		node* AVL_remove(const T&);
+		void AVL_filter(void);
+		inline void AVL_stale(unsigned int);
+		static int AVL_height(node*);
+		static node* AVL_link(node*, int, node*, node*, int, int&);
+		static node* AVL_join_right(node*, int, node*, node*, int, int&);
+		static node* AVL_join_left(node*, int, node*, node*, int, int&);
+		static node* AVL_join(node*, int, node*, node*, int, int&);
+		static node* AVL_split_last(node*, int, node*&, int&);
+		static node* AVL_join2(node*, int, node*, int, int&);
+		static node* AVL_split(node*, int, const T&, bool, node*&, int&, int&);
 		void AVL_copy(node*&, node*);
+		int AVL_build(node*&, const T*, unsigned int);
+		template <class F> void AVL_for_each(node*, F&) const;
 		void AVL_print(node*) const;
+		unsigned int AVL_small_find(const T&) const;
+		int AVL_small_insert(const T&);
+		void AVL_small_erase(unsigned int, unsigned int);
+		void AVL_spill(void);
+		static inline unsigned long long AVL_hash(const T&);
+		inline void AVL_cache(node*) const;
+		inline void AVL_uncache(node*);
 	public:
+		class node_handle {
+			friend class AVL<T, N>;
+			private:
+				node *p;
+				explicit node_handle(node* n): p(n) {}
+				node_handle(const node_handle&);
+				node_handle& operator=(const node_handle&);
+			public:
+				node_handle(void): p(0) {}
+				node_handle(node_handle&& h): p(h.p) { h.p = 0; }
+				~node_handle(void) { delete p; }
+				node_handle& operator=(node_handle&& h) {
+					if (this != &h) {
+						delete p;
+						p = h.p;
+						h.p = 0;
+					}
+					return *this;
+				}
+				bool empty(void) const { return !p; }
+				T& value(void) const { return p->data; }
+		};
 		AVL(void);
 		AVL(const AVL&);
+		AVL(AVL&&);
 		~AVL(void);
+		AVL<T, N>& operator=(const AVL&);
+		AVL<T, N>& operator=(AVL&&);
+		AVL<T, N>& swap(AVL&);
 		bool empty(void) const;
 		unsigned int size(void) const;
-		AVL<T>& clear(void);
+		AVL<T, N>& clear(void);
 		bool find(const T&) const;
-		AVL<T>& insert(const T&);
-		AVL<T>& extract(const T&);
+		AVL<T, N>& insert(const T&);
+		AVL<T, N>& extract(const T&);
+		node_handle extract_node(const T&);
+		AVL<T, N>& insert(node_handle&&);
+		AVL<T, N>& merge(AVL&);
+		AVL<T, N>& erase_range(const T&, const T&);
+		const T& min(void) const;
+		const T& max(void) const;
+		AVL<T, N>& pop_min(void);
+		AVL<T, N>& pop_max(void);
+		AVL<T, N>& build(const T*, unsigned int);
+		unsigned int depth(const T&) const;
+		template <class F> void for_each(F) const;
+		template <class F> void parallel_for_each(F, unsigned int = 0) const;
+		template <class R, class M, class C> R parallel_reduce(R, M, C, unsigned int = 0) const;
 		void print(void) const;
+		AVL<T, N>& compact(void);
+		bool compact_step(unsigned int);
+		unsigned long long rotations(void) const;
+		AVL<T, N>& set_filter(unsigned int);
+		double filter_fpr(void) const;
+		unsigned long long filter_memory(void) const;
+		AVL<T, N>& set_cache(unsigned int);
+		double cache_hit_rate(void) const;
+		MEM_usage memory_usage(void) const;
+		AVL<T, N>& set_memory_limit(unsigned long long);
 };
 
 
-template <class T>
-inline void AVL<T>::AVL_LL_rotate(node** p) {
+template <class T, unsigned int N>
+inline void AVL<T, N>::AVL_LL_rotate(node** p) {
 	node *t = *p;
 	*p = t->left;
 	t->left = (*p)->right;
 	(*p)->right = t;
 	t->balance = -(++(*p)->balance);
+	rotations_var++;
 }
 
 
-template <class T>
-inline void AVL<T>::AVL_RR_rotate(node** p) {
+template <class T, unsigned int N>
+inline void AVL<T, N>::AVL_RR_rotate(node** p) {
 	node *t = *p;
 	*p = t->right;
 	t->right = (*p)->left;
 	(*p)->left = t;
 	t->balance = -(--(*p)->balance);
+	rotations_var++;
 }
 
 
-template <class T>
-inline void AVL<T>::AVL_LR_rotate(node** p) {
+template <class T, unsigned int N>
+inline void AVL<T, N>::AVL_LR_rotate(node** p) {
 	node *t = *p, *l = t->left;
 	*p = l->right;
 	l->right = (*p)->left;
@@ -80,11 +258,12 @@ inline void AVL<T>::AVL_LR_rotate(node** p) {
 		t->balance = 0;
 	}
 	(*p)->balance = 0;
+	rotations_var += 2;
 }
 
 
-template <class T>
-inline void AVL<T>::AVL_RL_rotate(node** p) {
+template <class T, unsigned int N>
+inline void AVL<T, N>::AVL_RL_rotate(node** p) {
 	node *t = *p, *l = t->right;
 	*p = l->left;
 	l->left = (*p)->right;
@@ -99,127 +278,644 @@ inline void AVL<T>::AVL_RL_rotate(node** p) {
 		t->balance = 0;
 	}
 	(*p)->balance = 0;
+	rotations_var += 2;
 }
 
 
-template <class T>
-void AVL<T>::AVL_copy(node*& p, node* rp) {
+/* Returns the highest level (1 for the root) it may have rotated at */
+template <class T, unsigned int N>
+inline unsigned int AVL<T, N>::AVL_unwind(node*** pstack, node*** s, bool* b) {
+	node **p;
+	while (s != pstack) {
+		p = *s;
+		if (*b) {
+			if ((*p)->balance == 1) {
+				if ((*p)->right->balance != -1) {
+					AVL_RR_rotate(p);
+					if ((*p)->balance) return s-pstack;
+				} else AVL_RL_rotate(p);
+			} else if (++(*p)->balance) return s-pstack;
+		} else {
+			if ((*p)->balance == -1) {
+				if ((*p)->left->balance != 1) {
+					AVL_LL_rotate(p);
+					if ((*p)->balance) return s-pstack;
+				} else AVL_LR_rotate(p);
+			} else if (--(*p)->balance) return s-pstack;
+		}
+		b--;
+		s--;
+	}
+	return 1;
+}
+
+
+template <class T, unsigned int N>
+void AVL<T, N>::AVL_ends(void) {
+	lmost = rmost = root;
+	lspine.n = rspine.n = 0;
+	if (!root) return;
+	while (lmost->left) lmost = lmost->left;
+	while (rmost->right) rmost = rmost->right;
+}
+
+
+/*
+ * pop_min and pop_max keep the links from the root down to lmost and
+ * rmost (v[1] is &root, v[n] points to the end node) between calls. An
+ * update whose path went the other way above level top, the highest
+ * level it changed, leaves a spine alone; otherwise the spine is dropped.
+ */
+template <class T, unsigned int N>
+void AVL<T, N>::AVL_spines(const bool* dstack, unsigned int top) {
+	unsigned int i;
+	if (lspine.n) {
+		for (i = 1 ; i < top && dstack[i] ; i++) ;
+		if (i == top) lspine.n = 0;
+	}
+	if (rspine.n) {
+		for (i = 1 ; i < top && !dstack[i] ; i++) ;
+		if (i == top) rspine.n = 0;
+	}
+}
+
+
+/*
+ * Compaction copies nodes into regions, arrays of nodes allocated in one
+ * piece. A node in a region is destroyed in place and its slot chained
+ * into the region's spare list, from which inserts take new nodes before
+ * they turn to the heap. A region is released with its last node, except
+ * for the region a compaction pass is still filling (the last one).
+ */
+
+template <class T, unsigned int N>
+unsigned int AVL<T, N>::AVL_region(node* p) const {
+	std::less<node*> lt;
+	unsigned int i;
+	for (i = 0 ; i < regions.size() ; i++)
+		if (!lt(p, regions[i].base) && lt(p, regions[i].base+regions[i].size))
+			break;
+	return i;
+}
+
+
+template <class T, unsigned int N>
+void AVL<T, N>::AVL_add_region(unsigned int n) {
+	region r;
+	r.base = static_cast<node*>(::operator new(n*sizeof(node)));
+	r.size = r.live = 0;
+	r.cap = n;
+	r.spare = 0;
+	try {
+		regions.push_back(r);
+	} catch (...) {
+		::operator delete(r.base);
+		throw;
+	}
+}
+
+
+/* A node of d in a spare slot of a region, or else on the heap */
+template <class T, unsigned int N>
+typename AVL<T, N>::node* AVL<T, N>::AVL_new(const T& d) {
+	node *p;
+	for (unsigned int i = 0 ; i < regions.size() ; i++)
+		if ((p = regions[i].spare)) {
+			regions[i].spare = *reinterpret_cast<node**>(p);
+			try {
+				new (p) node(d);
+			} catch (...) {
+				*reinterpret_cast<node**>(p) = regions[i].spare;
+				regions[i].spare = p;
+				throw;
+			}
+			regions[i].live++;
+			return p;
+		}
+	if (limit_var) MEM_reserve(memory_usage(), MEM_chunk(sizeof(node)), limit_var);
+	return new node(d);
+}
+
+
+template <class T, unsigned int N>
+void AVL<T, N>::AVL_free(node* p) {
+	unsigned int i = AVL_region(p);
+	if (!cache.empty()) AVL_uncache(p);
+	if (i == regions.size()) {
+		delete p;
+		return;
+	}
+	p->~node();
+	if (!--regions[i].live && !(compacting && i == regions.size()-1)) {
+		::operator delete(regions[i].base);
+		regions.erase(regions.begin()+i);
+		return;
+	}
+	*reinterpret_cast<node**>(p) = regions[i].spare;
+	regions[i].spare = p;
+}
+
+
+/* Moves *p into the last region, or to the heap if it is full and *p is in an older one */
+template <class T, unsigned int N>
+void AVL<T, N>::AVL_move(node** p) {
+	region& r = regions.back();
+	node *t = *p, *q;
+	if (r.size == r.cap && AVL_region(t) == regions.size()) return;
+	if (!cache.empty()) AVL_uncache(t);
+	if (r.size < r.cap) {
+		q = new (r.base+r.size) node(std::move(*t));
+		r.size++;
+		r.live++;
+	} else q = new node(std::move(*t));
+	if (t == lmost) lmost = q;
+	if (t == rmost) rmost = q;
+	lspine.n = rspine.n = 0;
+	*p = q;
+	AVL_free(t);
+}
+
+
+/* Abandons any compaction pass and moves every node out of the regions onto the heap */
+template <class T, unsigned int N>
+void AVL<T, N>::AVL_evacuate(void) {
+	node **pstack[STACK], ***s = pstack, **p, *t;
+	delete cursor;
+	cursor = 0;
+	compacting = false;
+	lspine.n = rspine.n = 0;
+	if (!regions.empty() && !regions.back().live) {
+		::operator delete(regions.back().base);
+		regions.pop_back();
+	}
+	if (!root || regions.empty()) return;
+	*(++s) = &root;
+	while (s != pstack) {
+		p = *(s--);
+		if (AVL_region(*p) != regions.size()) {
+			t = *p;
+			if (!cache.empty()) AVL_uncache(t);
+			*p = new node(std::move(*t));
+			if (t == lmost) lmost = *p;
+			if (t == rmost) rmost = *p;
+			AVL_free(t);
+		}
+		if ((*p)->left) *(++s) = &((*p)->left);
+		if ((*p)->right) *(++s) = &((*p)->right);
+	}
+}
+
+
+template <class T, unsigned int N>
+unsigned int AVL<T, N>::AVL_clear(node* t) {
+	node **pstack[STACK], ***s = pstack, **p;
+	unsigned int c = 0;
+	*(++s) = &t;
+	while (s != pstack) {
+		p = *s;
+		if ((*p)->left) *(++s) = &((*p)->left);
+		else if ((*p)->right) *(++s) = &((*p)->right);
+		else {
+			AVL_free(*p);
+			*p = 0;
+			c++;
+			s--;
+		}
+	}
+	return c;
+}
+
+
+template <class T, unsigned int N>
+int AVL<T, N>::AVL_height(node* p) {
+	int h = 0;
+	for (; p ; h++)
+		p = p->balance == 1 ? p->right : p->left;
+	return h;
+}
+
+
+template <class T, unsigned int N>
+typename AVL<T, N>::node* AVL<T, N>::AVL_link(node* l, int hl, node* k,
+                                        node* r, int hr, int& h) {
+	k->left = l;
+	k->right = r;
+	k->balance = hr-hl;
+	h = (hl > hr ? hl : hr)+1;
+	return k;
+}
+
+
+template <class T, unsigned int N>
+typename AVL<T, N>::node* AVL<T, N>::AVL_join_right(node* l, int hl, node* k,
+                                              node* r, int hr, int& h) {
+	node *t, *c = l->right;
+	int hc = hl-1-(l->balance == -1), hll = hl-1-(l->balance == 1), ht;
+	if (hc <= hr+1)
+		t = AVL_link(c, hc, k, r, hr, ht);
+	else
+		t = AVL_join_right(c, hc, k, r, hr, ht);
+	if (ht <= hll+1)
+		return AVL_link(l->left, hll, l, t, ht, h);
+	int htl = ht-1-(t->balance == 1), htr = ht-1-(t->balance == -1), ha, hb;
+	if (htl <= htr) {
+		node *a = AVL_link(l->left, hll, l, t->left, htl, ha);
+		return AVL_link(a, ha, t, t->right, htr, h);
+	}
+	node *m = t->left;
+	int hml = htl-1-(m->balance == 1), hmr = htl-1-(m->balance == -1);
+	node *a = AVL_link(l->left, hll, l, m->left, hml, ha);
+	node *b = AVL_link(m->right, hmr, t, t->right, htr, hb);
+	return AVL_link(a, ha, m, b, hb, h);
+}
+
+
+template <class T, unsigned int N>
+typename AVL<T, N>::node* AVL<T, N>::AVL_join_left(node* l, int hl, node* k,
+                                             node* r, int hr, int& h) {
+	node *t, *c = r->left;
+	int hc = hr-1-(r->balance == 1), hrr = hr-1-(r->balance == -1), ht;
+	if (hc <= hl+1)
+		t = AVL_link(l, hl, k, c, hc, ht);
+	else
+		t = AVL_join_left(l, hl, k, c, hc, ht);
+	if (ht <= hrr+1)
+		return AVL_link(t, ht, r, r->right, hrr, h);
+	int htl = ht-1-(t->balance == 1), htr = ht-1-(t->balance == -1), ha, hb;
+	if (htr <= htl) {
+		node *a = AVL_link(t->right, htr, r, r->right, hrr, ha);
+		return AVL_link(t->left, htl, t, a, ha, h);
+	}
+	node *m = t->right;
+	int hml = htr-1-(m->balance == 1), hmr = htr-1-(m->balance == -1);
+	node *a = AVL_link(t->left, htl, t, m->left, hml, ha);
+	node *b = AVL_link(m->right, hmr, r, r->right, hrr, hb);
+	return AVL_link(a, ha, m, b, hb, h);
+}
+
+
+template <class T, unsigned int N>
+typename AVL<T, N>::node* AVL<T, N>::AVL_join(node* l, int hl, node* k,
+                                        node* r, int hr, int& h) {
+	if (hl > hr+1) return AVL_join_right(l, hl, k, r, hr, h);
+	if (hr > hl+1) return AVL_join_left(l, hl, k, r, hr, h);
+	return AVL_link(l, hl, k, r, hr, h);
+}
+
+
+template <class T, unsigned int N>
+typename AVL<T, N>::node* AVL<T, N>::AVL_split_last(node* p, int hp,
+                                              node*& last, int& h) {
+	int hl = hp-1-(p->balance == 1), hr = hp-1-(p->balance == -1);
+	if (!p->right) {
+		last = p;
+		h = hl;
+		return p->left;
+	}
+	node *r = AVL_split_last(p->right, hr, last, hr);
+	return AVL_join(p->left, hl, p, r, hr, h);
+}
+
+
+template <class T, unsigned int N>
+typename AVL<T, N>::node* AVL<T, N>::AVL_join2(node* l, int hl,
+                                         node* r, int hr, int& h) {
+	node *k;
+	if (!l) {
+		h = hr;
+		return r;
+	}
+	l = AVL_split_last(l, hl, k, hl);
+	return AVL_join(l, hl, k, r, hr, h);
+}
+
+
+template <class T, unsigned int N>
+typename AVL<T, N>::node* AVL<T, N>::AVL_split(node* p, int hp, const T& k, bool incl,
+                                         node*& r, int& hl, int& hr) {
+	node *l;
+	int pl, pr, h;
+	if (!p) {
+		r = 0;
+		hl = hr = 0;
+		return 0;
+	}
+	pl = hp-1-(p->balance == 1);
+	pr = hp-1-(p->balance == -1);
+	if (p->data < k || (incl && !(k < p->data))) {
+		l = AVL_split(p->right, pr, k, incl, r, h, hr);
+		return AVL_join(p->left, pl, p, l, h, hl);
+	}
+	l = AVL_split(p->left, pl, k, incl, r, hl, h);
+	r = AVL_join(r, h, p, p->right, pr, hr);
+	return l;
+}
+
+
+template <class T, unsigned int N>
+void AVL<T, N>::AVL_copy(node*& p, node* rp) {
 	p = new node(rp->data, rp->balance);
 	if (rp->left) AVL_copy(p->left, rp->left);
 	if (rp->right) AVL_copy(p->right, rp->right);
 }
 
 
-template <class T>
-void AVL<T>::AVL_print(node* p) const {
+template <class T, unsigned int N>
+int AVL<T, N>::AVL_build(node*& p, const T* a, unsigned int n) {
+	unsigned int m = n/2;
+	int l = 0, r = 0;
+	p = new node(a[m]);
+	if (m) l = AVL_build(p->left, a, m);
+	if (n-m-1) r = AVL_build(p->right, a+m+1, n-m-1);
+	p->balance = r-l;
+	return (l > r ? l : r)+1;
+}
+
+
+template <class T, unsigned int N>
+template <class F>
+void AVL<T, N>::AVL_for_each(node* p, F& f) const {
+	if (p->left) AVL_for_each(p->left, f);
+	f(p->data);
+	if (p->right) AVL_for_each(p->right, f);
+}
+
+
+template <class T, unsigned int N>
+void AVL<T, N>::AVL_print(node* p) const {
 	if (p->left) AVL_print(p->left);
 	std::cout << p->data << ' ';
 	if (p->right) AVL_print(p->right);
 }
 
 
-template <class T>
-AVL<T>::AVL(void):
-	root(0), size_var(0) {
-	pstack = new node**[sizeof(unsigned int)*12];
-	try {
-		dstack = new bool[sizeof(unsigned int)*12];
-	} catch (...) {
-		delete[] pstack;
-		throw;
+/*
+ * While the tree has no root its keys are the first size_var of the
+ * inline array (none if N is 0). The index of the first key not less
+ * than d, by a linear scan, which beats a search at these sizes.
+ */
+template <class T, unsigned int N>
+unsigned int AVL<T, N>::AVL_small_find(const T& d) const {
+	const T *a = this->keys();
+	unsigned int i = 0;
+	while (i < size_var && a[i] < d) i++;
+	return i;
+}
+
+
+/* 1 if d was added to the inline keys, 0 if it is there, -1 if they are full */
+template <class T, unsigned int N>
+int AVL<T, N>::AVL_small_insert(const T& d) {
+	T *a = this->keys();
+	unsigned int i = AVL_small_find(d), j = size_var;
+	if (i < size_var && a[i] == d) return 0;
+	if (size_var == N) return -1;
+	if (i == j) new (a+j) T(d);
+	else {
+		T t(d);
+		new (a+j) T(std::move(a[j-1]));
+		for (j-- ; j > i ; j--)
+			a[j] = std::move(a[j-1]);
+		a[i] = std::move(t);
 	}
+	size_var++;
+	return 1;
 }
 
 
-template <class T>
-AVL<T>::AVL(const AVL& param):
-	root(0), size_var(param.size_var) {
-	pstack = new node**[sizeof(unsigned int)*12];
+/* Removes the inline keys i .. j-1 */
+template <class T, unsigned int N>
+void AVL<T, N>::AVL_small_erase(unsigned int i, unsigned int j) {
+	T *a = this->keys();
+	if (i >= j) return;
+	for (; j < size_var ; i++, j++)
+		a[i] = std::move(a[j]);
+	for (j = i ; j < size_var ; j++)
+		a[j].~T();
+	size_var = i;
+}
+
+
+/* Builds the tree from the inline keys, before it grows past them */
+template <class T, unsigned int N>
+void AVL<T, N>::AVL_spill(void) {
+	T *a = this->keys();
+	if (!N || root || !size_var) return;
+	if (limit_var) MEM_reserve(memory_usage(), size_var*MEM_chunk(sizeof(node)), limit_var);
 	try {
-		dstack = new bool[sizeof(unsigned int)*12];
+		AVL_build(root, a, size_var);
 	} catch (...) {
-		delete[] pstack;
+		if (root) AVL_clear(root);
+		root = 0;
 		throw;
 	}
+	for (unsigned int i = 0 ; i < size_var ; i++)
+		a[i].~T();
+	AVL_ends();
+	if (filter.enabled()) AVL_filter();
+}
+
+
+template <class T, unsigned int N>
+AVL<T, N>::AVL(void):
+	root(0), lmost(0), rmost(0), size_var(0), rotations_var(0), cursor(0), compacting(false),
+	filter_stale(0), filter_rejects(0), filter_false(0), cache_hits(0), cache_misses(0),
+	limit_var(0) {}
+
+
+template <class T, unsigned int N>
+AVL<T, N>::AVL(const AVL& param):
+	root(0), lmost(0), rmost(0), size_var(param.size_var), rotations_var(0),
+	cursor(0), compacting(false), filter(param.filter), filter_stale(param.filter_stale),
+	filter_rejects(0), filter_false(0), cache(param.cache.size()), cache_hits(0), cache_misses(0),
+	limit_var(param.limit_var) {
 	if (param.root) {
 		try {
 			AVL_copy(root, param.root);
 		} catch (...) {
-			delete[] pstack;
-			delete[] dstack;
+			clear();
+			throw;
+		}
+	} else if (N) {
+		unsigned int i = 0;
+		try {
+			for (; i < size_var ; i++)
+				new (this->keys()+i) T(param.keys()[i]);
+		} catch (...) {
+			size_var = i;
 			clear();
 			throw;
 		}
 	}
+	AVL_ends();
 }
 
 
-template <class T>
-AVL<T>::~AVL(void) {
-	delete[] dstack;
+template <class T, unsigned int N>
+AVL<T, N>::AVL(AVL&& param):
+	root(0), lmost(0), rmost(0), size_var(0), rotations_var(0), cursor(0), compacting(false),
+	filter_stale(0), filter_rejects(0), filter_false(0), cache_hits(0), cache_misses(0),
+	limit_var(0) {
+	swap(param);
+}
+
+
+template <class T, unsigned int N>
+AVL<T, N>::~AVL(void) {
 	clear();
-	delete[] pstack;
 }
 
 
-template <class T>
-bool AVL<T>::empty(void) const {
-	return size_var == 0;
+template <class T, unsigned int N>
+AVL<T, N>& AVL<T, N>::operator=(const AVL& param) {
+	AVL<T, N> t(param);
+	return swap(t);
 }
 
 
-template <class T>
-unsigned int AVL<T>::size(void) const {
-	return size_var;
+template <class T, unsigned int N>
+AVL<T, N>& AVL<T, N>::operator=(AVL&& param) {
+	if (this != &param) {
+		clear();
+		swap(param);
+	}
+	return *this;
 }
 
 
-template <class T>
-AVL<T>& AVL<T>::clear(void) {
-	node ***s = pstack, **p;
-	if (!root) return *this;
-	*(++s) = &root;
-	while (s != pstack) {
-		p = *s;
-		if ((*p)->left) *(++s) = &((*p)->left);
-		else if ((*p)->right) *(++s) = &((*p)->right);
-		else {
-			delete *p;
-			*p = 0;
-			s--;
+/* Inline keys cannot trade places by pointer, so they are swapped one by one */
+template <class T, unsigned int N>
+AVL<T, N>& AVL<T, N>::swap(AVL& param) {
+	if (N && this != &param) {
+		AVL *x = this, *y = &param;
+		unsigned int i, m = root ? 0 : size_var, n = param.root ? 0 : param.size_var;
+		if (m > n) {
+			std::swap(x, y);
+			std::swap(m, n);
+		}
+		for (i = 0 ; i < m ; i++)
+			std::swap(x->keys()[i], y->keys()[i]);
+		for (; i < n ; i++) {
+			new (x->keys()+i) T(std::move(y->keys()[i]));
+			y->keys()[i].~T();
 		}
 	}
-	root = 0;
+	std::swap(root, param.root);
+	std::swap(lmost, param.lmost);
+	std::swap(rmost, param.rmost);
+	lspine.n = rspine.n = param.lspine.n = param.rspine.n = 0;
+	std::swap(size_var, param.size_var);
+	std::swap(rotations_var, param.rotations_var);
+	regions.swap(param.regions);
+	std::swap(cursor, param.cursor);
+	std::swap(compacting, param.compacting);
+	filter.swap(param.filter);
+	std::swap(filter_stale, param.filter_stale);
+	filter_rejects = param.filter_rejects.exchange(filter_rejects);
+	filter_false = param.filter_false.exchange(filter_false);
+	cache.swap(param.cache);
+	cache_hits = param.cache_hits.exchange(cache_hits);
+	cache_misses = param.cache_misses.exchange(cache_misses);
+	std::swap(limit_var, param.limit_var);
+	return *this;
+}
+
+
+template <class T, unsigned int N>
+bool AVL<T, N>::empty(void) const {
+	return size_var == 0;
+}
+
+
+template <class T, unsigned int N>
+unsigned int AVL<T, N>::size(void) const {
+	return size_var;
+}
+
+
+template <class T, unsigned int N>
+AVL<T, N>& AVL<T, N>::clear(void) {
+	if (root) AVL_clear(root);
+	else AVL_small_erase(0, size_var);
+	root = lmost = rmost = 0;
+	lspine.n = rspine.n = 0;
 	size_var = 0;
+	compacting = false;
+	delete cursor;
+	cursor = 0;
+	filter.clear();
+	filter_stale = 0;
+	for (unsigned int i = 0 ; i < regions.size() ; i++)
+		::operator delete(regions[i].base);
+	regions.clear();
 	return *this;
 }
 
 
-template <class T>
-bool AVL<T>::find(const T& d) const {
-	node *p = root;
+/* With a filter most absent keys are turned away without touching the tree */
+template <class T, unsigned int N>
+bool AVL<T, N>::find(const T& d) const {
+	const AVL_key<T> k(d);
+	node *p = root, *q;
+	int c;
+	if (N && !root) {
+		unsigned int i = AVL_small_find(d);
+		return i < size_var && this->keys()[i] == d;
+	}
+	if (!cache.empty()) {
+		unsigned long long h = AVL_hash(d);
+		const cache_set& e = cache[h & (cache.size()-1)];
+		for (unsigned int i = 0 ; i < 4 && (q = e.at(i)) ; i++)
+			if (e.tag[i].load(std::memory_order_relaxed) == (unsigned int)(h >> 32) && q->data == d) {
+				cache_hits.fetch_add(1, std::memory_order_relaxed);
+				return true;
+			}
+		cache_misses.fetch_add(1, std::memory_order_relaxed);
+	}
+	if (filter.enabled() && !filter.contains(d)) {
+		filter_rejects.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
 	while (p)
-		if (d < p->data) p = p->left;
-		else if (!(d == p->data)) p = p->right;
-		else return true;
+		if ((c = AVL_key<T>::compare(k, *p)) < 0 || (!c && d < p->data))
+			p = p->left;
+		else if (c > 0 || !(d == p->data))
+			p = p->right;
+		else {
+			if (!cache.empty()) AVL_cache(p);
+			return true;
+		}
+	if (filter.enabled()) filter_false.fetch_add(1, std::memory_order_relaxed);
 	return false;
 }
 
 
-template <class T>
-AVL<T>& AVL<T>::insert(const T& d) {
-	node ***s = pstack, **p = &root;
-	bool *b = dstack;
+/* Links n, or a new node of d if n is 0; false if d is already here */
+template <class T, unsigned int N>
+bool AVL<T, N>::AVL_insert(const T& d, node* n) {
+	const AVL_key<T> k(d);
+	node **pstack[STACK], ***s = pstack, **p = &root;
+	bool dstack[STACK], *b = dstack;
+	unsigned int top;
+	int c;
 	while (*p) {
 		*(++s) = p;
-		if ((*(++b) = (d < (*p)->data)))
+		c = AVL_key<T>::compare(k, **p);
+		if ((*(++b) = (c < 0 || (!c && d < (*p)->data))))
 			p = &((*p)->left);
-		else if (!(d == (*p)->data))
+		else if (c > 0 || !(d == (*p)->data))
 			p = &((*p)->right);
-		else return *this;
+		else return false;
 	}
-	*p = new node(d);
+	top = s-pstack+1;
+	*p = n ? n : AVL_new(d);
 	size_var++;
+	if (filter.enabled()) {
+		filter.add(d);
+		if (size_var > filter.capacity()) AVL_filter();
+	}
+	if (!lmost || d < lmost->data) lmost = *p;
+	if (!rmost || rmost->data < d) rmost = *p;
 	while (s != pstack) {
 		p = *s;
 		if (*b) {
@@ -228,50 +924,66 @@ AVL<T>& AVL<T>::insert(const T& d) {
 					AVL_LL_rotate(p);
 				else
 					AVL_LR_rotate(p);
-				return *this;
+				top = s-pstack;
+				break;
 			}
-			if (!--(*p)->balance) return *this;
+			if (!--(*p)->balance) break;
 		} else {
 			if ((*p)->balance == 1) {
 				if ((*p)->right->balance != -1)
 					AVL_RR_rotate(p);
 				else 
 					AVL_RL_rotate(p);
-				return *this;
+				top = s-pstack;
+				break;
 			}
-			if (!++(*p)->balance) return *this;
+			if (!++(*p)->balance) break;
 		}
 		b--;
 		s--;
 	}
-	return *this;
+	AVL_spines(dstack, top);
+	return true;
 }
 
 
-template <class T>
-AVL<T>& AVL<T>::extract(const T& d) {
-	node ***s = pstack, **p = &root, *t;
-	bool *b = dstack;
+/* Unlinks the node of d and returns it, or 0 if d is not here */
+template <class T, unsigned int N>
+typename AVL<T, N>::node* AVL<T, N>::AVL_remove(const T& d) {
+	const AVL_key<T> k(d);
+	node **pstack[STACK], ***s = pstack, **p = &root, *t, *x;
+	bool dstack[STACK], *b = dstack;
+	unsigned int top, i;
+	int c;
 	while (*p) {
 		*(++s) = p;
-		if ((*(++b) = (d < (*p)->data)))
+		c = AVL_key<T>::compare(k, **p);
+		if ((*(++b) = (c < 0 || (!c && d < (*p)->data))))
 			p = &((*p)->left);
-		else if (!(d == (*p)->data))
+		else if (c > 0 || !(d == (*p)->data))
 			p = &((*p)->right);
 		else break;
 	}
-	if (!(*p)) return *this;
+	if (!(*p)) return 0;
+	top = s-pstack;
 	size_var--;
+	if (*p == lmost) {
+		if ((lmost = lmost->right))
+			while (lmost->left) lmost = lmost->left;
+		else if (s-1 != pstack) lmost = **(s-1);
+	}
+	if (*p == rmost) {
+		if ((rmost = rmost->left))
+			while (rmost->right) rmost = rmost->right;
+		else if (s-1 != pstack) rmost = **(s-1);
+	}
+	x = *p;
 	if (!(*p)->left) {
-		t = *p;
 		*p = (*p)->right;
-		delete t;
 		b--;
 		s--;
 	} else if (!(*p)->right) {
-		t = *p;
 		*p = (*p)->left;
-		delete t;
 		b--;
 		s--;
 	} else {
@@ -287,53 +999,632 @@ AVL<T>& AVL<T>::extract(const T& d) {
 		t->balance = (*r)->balance;
 		t->left = (*r)->left;
 		t->right = (*r)->right;
-		delete *r;
 		*r = t;
 		*w = &(t->right);
 	}
-	while (s != pstack) {
-		p = *s;
-		if (*b) {
-			if ((*p)->balance == 1) {
-				if ((*p)->right->balance != -1) {
-					AVL_RR_rotate(p);
-					if ((*p)->balance) return *this;
-				} else AVL_RL_rotate(p);
-			} else if (++(*p)->balance) return *this;
+	i = AVL_unwind(pstack, s, b);
+	AVL_spines(dstack, i < top ? i : top);
+	x->left = x->right = 0;
+	x->balance = 0;
+	AVL_stale(1);
+	return x;
+}
+
+
+/*
+ * Refills the filter from the tree, sized with room for half as many
+ * keys again. Removed keys stay in a filter, raising its false positive
+ * rate, so it is also refilled once they outnumber half the tree. If the
+ * new filter cannot be allocated the old one, still correct, is kept.
+ */
+template <class T, unsigned int N>
+void AVL<T, N>::AVL_filter(void) {
+	BLOOM<T> t;
+	BLOOM_adder<T> f(t);
+	try {
+		t.reset(size_var+size_var/2+64, filter.bits_per_key());
+	} catch (...) {
+		return;
+	}
+	if (root) AVL_for_each(root, f);
+	filter.swap(t);
+	filter_stale = 0;
+}
+
+
+template <class T, unsigned int N>
+inline void AVL<T, N>::AVL_stale(unsigned int n) {
+	if (filter.enabled() && (filter_stale += n) > size_var/2+64) AVL_filter();
+}
+
+
+template <class T, unsigned int N>
+AVL<T, N>& AVL<T, N>::insert(const T& d) {
+	if (N && !root) {
+		if (AVL_small_insert(d) >= 0) return *this;
+		AVL_spill();
+	}
+	AVL_insert(d, 0);
+	return *this;
+}
+
+
+template <class T, unsigned int N>
+AVL<T, N>& AVL<T, N>::extract(const T& d) {
+	node *t;
+	if (N && !root) {
+		unsigned int i = AVL_small_find(d);
+		if (i < size_var && this->keys()[i] == d) AVL_small_erase(i, i+1);
+		return *this;
+	}
+	t = AVL_remove(d);
+	if (t) AVL_free(t);
+	return *this;
+}
+
+
+/*
+ * Unlinks the node of d without freeing it; the handle is empty if d is
+ * not here. A node in a compaction region is moved to the heap first.
+ */
+template <class T, unsigned int N>
+typename AVL<T, N>::node_handle AVL<T, N>::extract_node(const T& d) {
+	node *t, *q;
+	if (N && !root) {
+		unsigned int i = AVL_small_find(d);
+		if (i == size_var || !(this->keys()[i] == d)) return node_handle();
+		q = new node(std::move(this->keys()[i]));
+		AVL_small_erase(i, i+1);
+		return node_handle(q);
+	}
+	t = AVL_remove(d);
+	if (t && !cache.empty()) AVL_uncache(t);
+	if (!t || AVL_region(t) == regions.size()) return node_handle(t);
+	try {
+		q = new node(std::move(*t));
+	} catch (...) {
+		AVL_insert(t->data, t);
+		throw;
+	}
+	AVL_free(t);
+	return node_handle(q);
+}
+
+
+/* Takes the node out of h, unless its key is already here; then h keeps it */
+template <class T, unsigned int N>
+AVL<T, N>& AVL<T, N>::insert(node_handle&& h) {
+	if (!h.p) return *this;
+	if (N && !root) {
+		int r = AVL_small_insert(h.p->data);
+		if (r > 0) {
+			delete h.p;
+			h.p = 0;
+		}
+		if (r >= 0) return *this;
+		AVL_spill();
+	}
+	static_cast<AVL_key<T>&>(*h.p) = AVL_key<T>(h.p->data);
+	h.p->left = h.p->right = 0;
+	h.p->balance = 0;
+	if (AVL_insert(h.p->data, h.p)) h.p = 0;
+	return *this;
+}
+
+
+/*
+ * Moves every node of param whose key is not here, without allocating;
+ * the rest stay in param. Nodes of param in compaction regions are moved
+ * to the heap first. The detached tree is unrolled by right rotations,
+ * so no stack is needed to walk it.
+ */
+template <class T, unsigned int N>
+AVL<T, N>& AVL<T, N>::merge(AVL& param) {
+	node *p, *t;
+	if (&param == this || !param.size_var) return *this;
+	param.AVL_spill();
+	AVL_spill();
+	param.AVL_evacuate();
+	param.filter.clear();
+	param.filter_stale = 0;
+	for (unsigned int i = 0 ; i < param.cache.size() ; i++)
+		param.cache[i].clear();
+	p = param.root;
+	param.root = param.lmost = param.rmost = 0;
+	param.lspine.n = param.rspine.n = 0;
+	param.size_var = 0;
+	while (p)
+		if (p->left) {
+			t = p->left;
+			p->left = t->right;
+			t->right = p;
+			p = t;
 		} else {
-			if ((*p)->balance == -1) {
-				if ((*p)->left->balance != 1) {
-					AVL_LL_rotate(p);
-					if ((*p)->balance) return *this;
-				} else AVL_LR_rotate(p);
-			} else if (--(*p)->balance) return *this;
+			t = p;
+			p = p->right;
+			t->right = 0;
+			t->balance = 0;
+			if (!AVL_insert(t->data, t))
+				param.AVL_insert(t->data, t);
 		}
-		b--;
-		s--;
+	return *this;
+}
+
+
+template <class T, unsigned int N>
+AVL<T, N>& AVL<T, N>::erase_range(const T& lo, const T& hi) {
+	node *l, *m, *r;
+	int hl, hm, hr, h;
+	unsigned int c = 0;
+	if (hi < lo) return *this;
+	if (N && !root) {
+		unsigned int i = AVL_small_find(hi);
+		if (i < size_var && this->keys()[i] == hi) i++;
+		AVL_small_erase(AVL_small_find(lo), i);
+		return *this;
 	}
+	if (!root) return *this;
+	l = AVL_split(root, AVL_height(root), lo, false, m, hl, hm);
+	m = AVL_split(m, hm, hi, true, r, hm, hr);
+	if (m) size_var -= (c = AVL_clear(m));
+	root = AVL_join2(l, hl, r, hr, h);
+	AVL_ends();
+	AVL_stale(c);
 	return *this;
 }
 
 
-template <class T>
-void AVL<T>::print(void) const {
+/* The least key; the tree must not be empty */
+template <class T, unsigned int N>
+const T& AVL<T, N>::min(void) const {
+	if (N && !root) return this->keys()[0];
+	return lmost->data;
+}
+
+
+/* The greatest key; the tree must not be empty */
+template <class T, unsigned int N>
+const T& AVL<T, N>::max(void) const {
+	if (N && !root) return this->keys()[size_var-1];
+	return rmost->data;
+}
+
+
+/*
+ * Removes the least key. The spine down to it is kept from the last pop,
+ * so a pop only retraces the levels its rebalancing went through: O(1)
+ * for most pops, and O(log n) after an update that moved the spine. If
+ * the spine cannot be allocated it is walked from the root every time.
+ */
+template <class T, unsigned int N>
+AVL<T, N>& AVL<T, N>::pop_min(void) {
+	node **local[STACK+1], ***v = local, **p, *t;
+	unsigned int n = 0, i;
+	if (N && !root) AVL_small_erase(0, size_var ? 1 : 0);
+	if (!root) return *this;
+	if (lspine.v.empty()) {
+		try {
+			lspine.v.resize(STACK+1);
+		} catch (...) {}
+	}
+	if (!lspine.v.empty()) {
+		v = &lspine.v[0];
+		n = lspine.n;
+	}
+	if (!n)
+		for (p = &root ; *p ; p = &((*p)->left))
+			v[++n] = p;
+	t = *v[n];
+	*v[n] = t->right;
+	for (i = n-1 ; i ; i--) {
+		p = v[i];
+		if ((*p)->balance == 1) {
+			if ((*p)->right->balance != -1) {
+				AVL_RR_rotate(p);
+				if ((*p)->balance) break;
+			} else AVL_RL_rotate(p);
+		} else if (++(*p)->balance) break;
+	}
+	if (!i) i = 1;
+	for (n = i-1, p = v[i] ; *p ; p = &((*p)->left))
+		v[++n] = p;
+	lmost = n ? *v[n] : 0;
+	if (t == rmost) rmost = lmost;
+	if (i == 1) rspine.n = 0;
+	if (v != local) lspine.n = n;
+	AVL_free(t);
+	size_var--;
+	AVL_stale(1);
+	return *this;
+}
+
+
+/* Removes the greatest key, as pop_min does the least */
+template <class T, unsigned int N>
+AVL<T, N>& AVL<T, N>::pop_max(void) {
+	node **local[STACK+1], ***v = local, **p, *t;
+	unsigned int n = 0, i;
+	if (N && !root && size_var) AVL_small_erase(size_var-1, size_var);
+	if (!root) return *this;
+	if (rspine.v.empty()) {
+		try {
+			rspine.v.resize(STACK+1);
+		} catch (...) {}
+	}
+	if (!rspine.v.empty()) {
+		v = &rspine.v[0];
+		n = rspine.n;
+	}
+	if (!n)
+		for (p = &root ; *p ; p = &((*p)->right))
+			v[++n] = p;
+	t = *v[n];
+	*v[n] = t->left;
+	for (i = n-1 ; i ; i--) {
+		p = v[i];
+		if ((*p)->balance == -1) {
+			if ((*p)->left->balance != 1) {
+				AVL_LL_rotate(p);
+				if ((*p)->balance) break;
+			} else AVL_LR_rotate(p);
+		} else if (--(*p)->balance) break;
+	}
+	if (!i) i = 1;
+	for (n = i-1, p = v[i] ; *p ; p = &((*p)->right))
+		v[++n] = p;
+	rmost = n ? *v[n] : 0;
+	if (t == lmost) lmost = rmost;
+	if (i == 1) lspine.n = 0;
+	if (v != local) rspine.n = n;
+	AVL_free(t);
+	size_var--;
+	AVL_stale(1);
+	return *this;
+}
+
+
+template <class T, unsigned int N>
+AVL<T, N>& AVL<T, N>::build(const T* a, unsigned int n) {
+	if (limit_var && n > N) MEM_reserve(MEM_usage(), n*MEM_chunk(sizeof(node)), limit_var);
+	clear();
+	if (!n) return *this;
+	if (n <= N) {
+		for (unsigned int i = 0 ; i < n ; i++, size_var++)
+			new (this->keys()+i) T(a[i]);
+		return *this;
+	}
+	try {
+		AVL_build(root, a, n);
+	} catch (...) {
+		clear();
+		throw;
+	}
+	size_var = n;
+	AVL_ends();
+	if (filter.enabled()) AVL_filter();
+	return *this;
+}
+
+
+template <class T, unsigned int N>
+unsigned int AVL<T, N>::depth(const T& d) const {
+	const AVL_key<T> k(d);
+	unsigned int c = 0;
+	node *p = root;
+	int r;
+	if (N && !root) {
+		c = AVL_small_find(d);
+		return c < size_var ? c+1 : c;
+	}
+	while (p) {
+		c++;
+		if ((r = AVL_key<T>::compare(k, *p)) < 0 || (!r && d < p->data))
+			p = p->left;
+		else if (r > 0 || !(d == p->data))
+			p = p->right;
+		else break;
+	}
+	return c;
+}
+
+
+template <class T, unsigned int N>
+template <class F>
+void AVL<T, N>::for_each(F f) const {
+	if (root) AVL_for_each(root, f);
+	else for (unsigned int i = 0 ; i < size_var ; i++)
+		f(this->keys()[i]);
+}
+
+
+template <class T, unsigned int N>
+void AVL<T, N>::print(void) const {
 	if (root) AVL_print(root);
+	else for (unsigned int i = 0 ; i < size_var ; i++)
+		std::cout << this->keys()[i] << ' ';
 	std::cout << std::endl;
 }
 
 
+/*
+ * Copies every node into a new region in breadth first order, so that
+ * the top levels of the tree share cache lines, and releases the old
+ * memory. Any incremental pass in progress is abandoned.
+ */
+template <class T, unsigned int N>
+AVL<T, N>& AVL<T, N>::compact(void) {
+	delete cursor;
+	cursor = 0;
+	if (compacting && !regions.back().live) {
+		::operator delete(regions.back().base);
+		regions.pop_back();
+	}
+	compacting = false;
+	if (!root) return *this;
+	AVL_add_region(size_var);
+	compacting = true;
+	AVL_move(&root);
+	for (unsigned int i = 0 ; i < regions.back().size ; i++) {
+		node *p = regions.back().base+i;
+		if (p->left) AVL_move(&(p->left));
+		if (p->right) AVL_move(&(p->right));
+	}
+	compacting = false;
+	return *this;
+}
+
+
+/*
+ * Incremental compaction: visits at most budget nodes and returns true
+ * once a pass is complete. A pass moves the nodes in key order after a
+ * saved cursor key, so every subtree ends up contiguous and the walk stays
+ * exact whatever the tree did between two steps. Nodes inserted behind
+ * the cursor stay on the heap until the next pass.
+ */
+template <class T, unsigned int N>
+bool AVL<T, N>::compact_step(unsigned int budget) {
+	node **pstack[STACK], ***s = pstack, **p = &root, *last = 0;
+	if (!compacting) {
+		if (!root) return true;
+		AVL_add_region(size_var);
+		compacting = true;
+	}
+	while (*p)
+		if (!cursor || *cursor < (*p)->data) {
+			*(++s) = p;
+			p = &((*p)->left);
+		} else p = &((*p)->right);
+	for (; s != pstack && budget ; budget--) {
+		p = *(s--);
+		if (AVL_region(*p) != regions.size()-1) AVL_move(p);
+		last = *p;
+		for (p = &(last->right) ; *p ; p = &((*p)->left))
+			*(++s) = p;
+	}
+	if (s != pstack) {
+		if (cursor && last) *cursor = last->data;
+		else if (last) cursor = new T(last->data);
+		return false;
+	}
+	delete cursor;
+	cursor = 0;
+	compacting = false;
+	if (!regions.back().live) {
+		::operator delete(regions.back().base);
+		regions.pop_back();
+	}
+	return true;
+}
+
+
+
+/* Rotations done by insert and extract; double rotations count twice */
+template <class T, unsigned int N>
+unsigned long long AVL<T, N>::rotations(void) const {
+	return rotations_var;
+}
+
+
+/*
+ * Puts a blocked Bloom filter of b bits per key in front of find, kept
+ * up by every update; b = 0 removes it. About 10 bits give 1% false
+ * positives. find counts its outcomes in relaxed atomics, so concurrent
+ * finds need no lock.
+ */
+template <class T, unsigned int N>
+AVL<T, N>& AVL<T, N>::set_filter(unsigned int b) {
+	BLOOM_adder<T> f(filter);
+	filter.reset(size_var+size_var/2+64, b);
+	filter_stale = 0;
+	filter_rejects = filter_false = 0;
+	if (b && root) AVL_for_each(root, f);
+	return *this;
+}
+
+
+/* Of the finds of absent keys since set_filter, the share the filter let through */
+template <class T, unsigned int N>
+double AVL<T, N>::filter_fpr(void) const {
+	unsigned long long n = filter_rejects+filter_false;
+	return n ? (double)filter_false/n : 0;
+}
+
+
+/* Bytes taken by the filter */
+template <class T, unsigned int N>
+unsigned long long AVL<T, N>::filter_memory(void) const {
+	return filter.memory();
+}
+
+
+/* std::hash is often the identity, so the result is mixed (murmur3 finalizer) */
+template <class T, unsigned int N>
+inline unsigned long long AVL<T, N>::AVL_hash(const T& d) {
+	unsigned long long h = std::hash<T>()(d);
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+
+/* Puts p first in the set of its key, dropping the one cached longest ago */
+template <class T, unsigned int N>
+inline void AVL<T, N>::AVL_cache(node* p) const {
+	unsigned long long h = AVL_hash(p->data);
+	cache_set& e = cache[h & (cache.size()-1)];
+	for (unsigned int i = 3 ; i ; i--)
+		e.copy(i, i-1);
+	e.put(0, p, (unsigned int)(h >> 32));
+}
+
+
+/* Forgets p, before it is freed, moved or taken out of the tree */
+template <class T, unsigned int N>
+inline void AVL<T, N>::AVL_uncache(node* p) {
+	cache_set& e = cache[AVL_hash(p->data) & (cache.size()-1)];
+	for (unsigned int i = 0 ; i < 4 ; i++)
+		if (e.at(i) == p) {
+			for (; i < 3 ; i++)
+				e.copy(i, i+1);
+			e.put(3, 0, 0);
+			return;
+		}
+}
+
+
+/*
+ * Puts a 4 way set associative cache of about n recently found keys in
+ * front of find, mapping each to its node, so hot keys skip the walk
+ * down the tree; n = 0 removes it. A node leaves the cache when it is
+ * freed, moved by compaction or taken out of the tree. Inserts leave the
+ * cache alone, as they move no node and only found keys are cached. A
+ * hit only reads the cache and a miss that finds its key stores it with
+ * relaxed atomics, so concurrent finds need no lock: racing stores may
+ * drop or repeat an entry, but every entry is a node of the tree and its
+ * key is compared before it is used.
+ */
+template <class T, unsigned int N>
+AVL<T, N>& AVL<T, N>::set_cache(unsigned int n) {
+	unsigned int m = 1;
+	while (m < 1u << 30 && 4*m < n) m *= 2;
+	std::vector<cache_set>(n ? m : 0).swap(cache);
+	cache_hits = cache_misses = 0;
+	return *this;
+}
+
+
+/* Of the finds since set_cache, the share answered by the cache */
+template <class T, unsigned int N>
+double AVL<T, N>::cache_hit_rate(void) const {
+	unsigned long long n = cache_hits+cache_misses;
+	return n ? (double)cache_hits/n : 0;
+}
+
+
+/* Compaction regions count as slack for their free slots */
+template <class T, unsigned int N>
+MEM_usage AVL<T, N>::memory_usage(void) const {
+	MEM_usage u;
+	unsigned int live = 0;
+	for (unsigned int i = 0 ; i < regions.size() ; i++) {
+		live += regions[i].live;
+		u.nodes += (unsigned long long)regions[i].live*sizeof(node);
+		u.slack += MEM_chunk((unsigned long long)regions[i].cap*sizeof(node))-
+		           (unsigned long long)regions[i].live*sizeof(node);
+	}
+	if (root) MEM_nodes(u, size_var-live, sizeof(node));
+	MEM_block(u, regions.capacity()*sizeof(region));
+	MEM_block(u, filter.memory());
+	MEM_block(u, cache.capacity()*sizeof(cache_set));
+	MEM_vector(u, lspine.v);
+	MEM_vector(u, rspine.v);
+	if (cursor) MEM_block(u, sizeof(T));
+	return u;
+}
+
+
+/*
+ * Makes inserts, spills and builds that would take the heap use past
+ * bytes throw std::bad_alloc, leaving the tree as it was; 0 removes the
+ * limit. The limit is not checked on every allocation, so a refilled
+ * filter or a compaction region can still pass it.
+ */
+template <class T, unsigned int N>
+AVL<T, N>& AVL<T, N>::set_memory_limit(unsigned long long bytes) {
+	limit_var = bytes;
+	return *this;
+}
+
+
+/*
+ * Calls f on every key from several threads, in no order; f must be
+ * thread safe. If it throws, the walk stops and the first exception is
+ * rethrown once every thread has finished.
+ */
+template <class T, unsigned int N>
+template <class F>
+void AVL<T, N>::parallel_for_each(F f, unsigned int threads) const {
+	if (N && !root) for_each(f);
+	else PAR_for_each(root, size_var, f, threads);
+}
+
+
+/*
+ * combine(init, map(k)) over all keys k; combine must be associative and
+ * commutative. Exceptions from map or combine are passed on as by
+ * parallel_for_each.
+ */
+template <class T, unsigned int N>
+template <class R, class M, class C>
+R AVL<T, N>::parallel_reduce(R init, M map, C combine, unsigned int threads) const {
+	if (N && !root) {
+		for (unsigned int i = 0 ; i < size_var ; i++)
+			init = combine(init, map(this->keys()[i]));
+		return init;
+	}
+	return PAR_reduce(root, size_var, init, map, combine, threads);
+}
+
 
 /* Testing main */
 
+#ifndef NO_TESTING_MAIN
+
 #include <cstdlib>
 #include <ctime>
+#include <cmath>
+#include "perf-counters.h"
 using namespace std;
 
 
+/* Keys of rank r drawn with probability about 1/r (Zipf), scattered over 1..n */
+static int zipf(int n) {
+	int r = (int)exp(log((double)n)*rand()/RAND_MAX);
+	return (int)((long long)r*2654435761u%n)+1;
+}
+
+
+/* n/8 sets of up to 8 keys out of 32, then n lookups spread over them */
+template <class A>
+int small_sets(int n) {
+	vector<A> v(n/8+1);
+	int i, j;
+	for (i = 0 ; i < n ; i++)
+		v[i/8].insert(rand()%32);
+	for (i = j = 0 ; i < n ; i++)
+		j += v[rand()%v.size()].find(rand()%32);
+	return j;
+}
+
+
 int main(int argc, char **argv)
 {
 	int i, j, n;
 	double t;
+	PERF perf;
 	AVL<int> tree;
 	if (argc > 3) return EXIT_FAILURE;
 	i = time(0);
@@ -347,32 +1638,129 @@ int main(int argc, char **argv)
 	cout << "Seed is " << i << endl;
 	cout << "Inserting..." << endl;
 	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
 	for (i = 1 ; i <= n ; i++) {
 		j = rand()%n+1;
 	//	cout << j << ' ';
 		tree.insert(j);
 	}
+	perf.stop();
 	t = ((double)clock())/CLOCKS_PER_SEC-t;
 	cout << t << " secs" << endl;
+	perf.report(n);
 //	cout << "\nPrinting tree..." << endl;
 //	tree.print();
 	cout << "Size of tree is: " << tree.size() << endl;
+	cout << "Memory used is: " << tree.memory_usage() << endl;
+	if (!tree.empty())
+		cout << "Min is " << tree.min() << ", max is " << tree.max() << endl;
 	cout << "Extracting..." << endl;
 	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
 	for (i = 1 ; i <= n ; i++) {
 		j = rand()%n+1;
 	//	cout << j << ' ';
 		tree.extract(j);
 	}
+	perf.stop();
 	t = ((double)clock())/CLOCKS_PER_SEC-t;
 	cout << t << " secs" << endl;
+	perf.report(n);
 //	cout << "\nPrinting tree..." << endl;
 //	tree.print();
 	cout << "Size of tree is: " << tree.size() << endl;
+	for (int k = 0 ; k < 3 ; k++) {
+		cout << "Looking up..." << endl;
+		t = ((double)clock())/CLOCKS_PER_SEC;
+		perf.start();
+		for (i = j = 0 ; i < n ; i++)
+			j += tree.find(rand()%n+1);
+		perf.stop();
+		t = ((double)clock())/CLOCKS_PER_SEC-t;
+		cout << t << " secs, " << j << " found" << endl;
+		perf.report(n);
+		if (k == 2) {
+			cout << "Filter false positive rate is: " << tree.filter_fpr()
+			     << ", memory: " << tree.filter_memory() << " bytes" << endl;
+			break;
+		}
+		cout << (k ? "Adding filter..." : "Compacting...") << endl;
+		t = ((double)clock())/CLOCKS_PER_SEC;
+		perf.start();
+		if (k) tree.set_filter(10);
+		else tree.compact();
+		perf.stop();
+		t = ((double)clock())/CLOCKS_PER_SEC-t;
+		cout << t << " secs" << endl;
+		perf.report(n);
+	}
+	for (int k = 0 ; k < 2 ; k++) {
+		vector<int> v(n);
+		for (i = 0 ; i < n ; i++)
+			v[i] = zipf(n);
+		cout << (k ? "Looking up hot keys with cache..." : "Looking up hot keys...") << endl;
+		if (k) tree.set_cache(4096);
+		t = ((double)clock())/CLOCKS_PER_SEC;
+		perf.start();
+		for (i = j = 0 ; i < n ; i++)
+			j += tree.find(v[i]);
+		perf.stop();
+		t = ((double)clock())/CLOCKS_PER_SEC-t;
+		cout << t << " secs, " << j << " found" << endl;
+		perf.report(n);
+		if (k) cout << "Cache hit rate is: " << tree.cache_hit_rate() << endl;
+	}
+	for (int k = 1 ; k >= 0 ; k--) {
+		long long s;
+		cout << (k ? "Summing..." : "Summing in parallel...") << endl;
+		t = ((double)clock())/CLOCKS_PER_SEC;
+		perf.start();
+		s = tree.parallel_reduce(0LL, [](int d) { return (long long)d; },
+		                         [](long long a, long long b) { return a+b; }, k);
+		perf.stop();
+		t = ((double)clock())/CLOCKS_PER_SEC-t;
+		cout << t << " secs, sum is " << s << endl;
+		perf.report(n);
+	}
+	for (int k = 0 ; k < 2 ; k++) {
+		cout << (k ? "Small sets, keys inline..." : "Small sets, keys in nodes...") << endl;
+		t = ((double)clock())/CLOCKS_PER_SEC;
+		perf.start();
+		j = k ? small_sets<AVL<int, 8> >(n) : small_sets<AVL<int> >(n);
+		perf.stop();
+		t = ((double)clock())/CLOCKS_PER_SEC-t;
+		cout << t << " secs, " << j << " found" << endl;
+		perf.report(n);
+	}
+	cout << "Inserting up to a memory limit 1MB above the current use..." << endl;
+	tree.set_memory_limit(tree.memory_usage().total()+(1 << 20));
+	t = ((double)clock())/CLOCKS_PER_SEC;
+	try {
+		for (i = 1 ; ; i++)
+			tree.insert(n+i);
+	} catch (bad_alloc&) {}
+	t = ((double)clock())/CLOCKS_PER_SEC-t;
+	tree.set_memory_limit(0);
+	cout << t << " secs, " << i-1 << " inserted, memory used is: " << tree.memory_usage() << endl;
+	cout << "Popping half the keys from the minimum..." << endl;
+	j = tree.size()/2;
+	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
+	for (i = 0 ; i < j ; i++)
+		tree.pop_min();
+	perf.stop();
+	t = ((double)clock())/CLOCKS_PER_SEC-t;
+	cout << t << " secs" << endl;
+	perf.report(j);
 	cout << "Clearing..." << endl;
 	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
 	tree.clear();
+	perf.stop();
 	t = ((double)clock())/CLOCKS_PER_SEC-t;
 	cout << t << " secs" << endl;
+	perf.report(n);
 	return EXIT_SUCCESS;
 }
+
+#endif
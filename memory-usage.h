@@ -0,0 +1,91 @@
+/*
+ * C++ Memory accounting for the trees
+ * Written by orestisp
+ * std06176@di.uoa.gr
+ */
+
+
+
+#ifndef MEMORY_USAGE_H
+#define MEMORY_USAGE_H
+
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <new>
+
+
+/*
+ * Heap bytes held by a tree: its nodes as sizeof counts them, what the
+ * allocator takes on top of every block (headers, rounding, unused room
+ * in pools) and every other buffer (filters, caches, stacks, logs). The
+ * tree object itself is not counted, as it need not be on the heap.
+ */
+
+struct MEM_usage {
+	unsigned long long nodes;
+	unsigned long long slack;
+	unsigned long long aux;
+	MEM_usage(void): nodes(0), slack(0), aux(0) {}
+	unsigned long long total(void) const { return nodes+slack+aux; }
+};
+
+
+/*
+ * Bytes malloc takes for a block of n: glibc adds an 8 byte header and
+ * rounds up to 16, at least 32, and maps big blocks (128K by default) in
+ * whole pages. Elsewhere the overhead is unknown and taken as none.
+ */
+static inline unsigned long long MEM_chunk(unsigned long long n) {
+#ifdef __GLIBC__
+	if (n+8 >= 128*1024) return (n+16+4095) & ~4095ULL;
+	return n+8 < 32 ? 32 : (n+8+15) & ~15ULL;
+#else
+	return n;
+#endif
+}
+
+
+/* count blocks of size bytes, each holding one node */
+static inline void MEM_nodes(MEM_usage& u, unsigned long long count, unsigned long long size) {
+	u.nodes += count*size;
+	u.slack += count*(MEM_chunk(size)-size);
+}
+
+
+/* One auxiliary block of n bytes, if there is one */
+static inline void MEM_block(MEM_usage& u, unsigned long long n) {
+	if (!n) return;
+	u.aux += n;
+	u.slack += MEM_chunk(n)-n;
+}
+
+
+template <class E>
+static inline void MEM_vector(MEM_usage& u, const std::vector<E>& v) {
+	MEM_block(u, v.capacity()*sizeof(E));
+}
+
+
+/* As libstdc++ lays a deque out: 512 byte buffers and a map of at least 8 pointers */
+template <class E>
+static inline void MEM_deque(MEM_usage& u, const std::deque<E>& d) {
+	unsigned long long per = sizeof(E) < 512 ? 512/sizeof(E) : 1, n = d.size()/per+1;
+	u.aux += n*per*sizeof(E);
+	u.slack += n*(MEM_chunk(per*sizeof(E))-per*sizeof(E));
+	MEM_block(u, (n+2 < 8 ? 8 : n+2)*sizeof(E*));
+}
+
+
+/* Fails with std::bad_alloc, before anything is allocated, if n more bytes pass the limit (0: none) */
+static inline void MEM_reserve(const MEM_usage& u, unsigned long long n, unsigned long long limit) {
+	if (limit && u.total()+n > limit) throw std::bad_alloc();
+}
+
+
+static inline std::ostream& operator<<(std::ostream& out, const MEM_usage& u) {
+	return out << u.total() << " bytes (nodes " << u.nodes << ", slack "
+	           << u.slack << ", other " << u.aux << ")";
+}
+
+#endif
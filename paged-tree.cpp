@@ -0,0 +1,845 @@
+/*
+ * C++ Paged B+ Tree implementation
+ * Written by orestisp
+ * std06176@di.uoa.gr
+ */
+
+
+
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <string>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+
+/*
+ * A B+ tree kept in a file of P byte pages, for key sets larger than
+ * memory. Page 0 is a header; every other page is a leaf (a sorted array
+ * of keys, chained to the next leaf) or an internal node (separators and
+ * child page numbers, keys >= a separator go right). Pages are only
+ * touched through a buffer pool of a fixed number of frames: a page is
+ * pinned while in use and the least recently used unpinned frame is
+ * written back, if dirty, and reused. Freed pages are chained in a free
+ * list and reused before the file grows. T is copied to and from the
+ * file as raw bytes, so it must be trivially copyable. I/O errors throw
+ * std::runtime_error; the tree should not be used after one.
+ */
+
+template <class T, unsigned int P = 4096>
+class PT {
+	private:
+		struct head {
+			unsigned int leaf;
+			unsigned int count;
+			unsigned long long next;
+		};
+		struct meta {
+			char magic[8];
+			unsigned int page_size;
+			unsigned int key_size;
+			unsigned long long root;
+			unsigned long long height;
+			unsigned long long size;
+			unsigned long long pages;
+			unsigned long long free;
+		};
+		struct frame {
+			unsigned long long page;
+			unsigned int pins;
+			bool dirty;
+			unsigned int prev;
+			unsigned int next;
+		};
+		enum {
+			LEAF_KEYS = (P-sizeof(head))/sizeof(T),
+			INNER_KEYS = (P-sizeof(head)-sizeof(unsigned long long))/
+				(sizeof(T)+sizeof(unsigned long long)),
+			NONE = ~0u
+		};
+		static_assert(std::is_trivially_copyable<T>::value, "keys are stored as raw bytes");
+		static_assert(LEAF_KEYS >= 4 && INNER_KEYS >= 4, "page too small for the key");
+		int fd;
+		unsigned long long root;
+		unsigned long long height;
+		unsigned long long size_var;
+		unsigned long long pages_var;
+		unsigned long long free_var;
+		unsigned long long reads_var;
+		unsigned long long writes_var;
+		char *pool;
+		frame *frames;
+		unsigned int frames_var;
+		unsigned int lru;
+		unsigned int mru;
+		std::unordered_map<unsigned long long, unsigned int> table;
+		PT(const PT&);
+		PT& operator=(const PT&);
+		static head* H(char* p) { return reinterpret_cast<head*>(p); }
+		static T* K(char* p) { return reinterpret_cast<T*>(p+sizeof(head)); }
+		static unsigned long long* C(char* p) {
+			return reinterpret_cast<unsigned long long*>(p+sizeof(head));
+		}
+		static T* S(char* p) { return reinterpret_cast<T*>(C(p)+INNER_KEYS+1); }
+		static unsigned int PT_lower(const T*, unsigned int, const T&);
+		static unsigned int PT_upper(const T*, unsigned int, const T&);
+		void PT_open(const char*, bool);
+		void PT_alloc(unsigned int);
+		void PT_read(unsigned long long, char*);
+		void PT_write(unsigned long long, const char*);
+		inline char* PT_data(unsigned int) const;
+		void PT_unlink(unsigned int);
+		void PT_push(unsigned int);
+		unsigned int PT_pin(unsigned long long, bool = true);
+		inline void PT_unpin(unsigned int, bool = false);
+		unsigned int PT_new(unsigned long long&);
+		void PT_free(unsigned int);
+		void PT_drop(void);
+		int PT_insert(unsigned long long, unsigned long long, const T&,
+		              T&, unsigned long long&);
+		int PT_extract(unsigned long long, unsigned long long, const T&);
+		bool PT_fix(unsigned int, unsigned int, bool);
+	public:
+		PT(unsigned int = 1024);
+		PT(const char*, unsigned int = 1024);
+		~PT(void);
+		bool empty(void) const;
+		unsigned long long size(void) const;
+		unsigned long long pages(void) const;
+		unsigned long long reads(void) const;
+		unsigned long long writes(void) const;
+		PT<T, P>& clear(void);
+		PT<T, P>& flush(void);
+		bool find(const T&);
+		PT<T, P>& insert(const T&);
+		PT<T, P>& extract(const T&);
+		template <class F> void for_each(F);
+		void print(void);
+};
+
+
+/* Index of the first key not less than d */
+template <class T, unsigned int P>
+unsigned int PT<T, P>::PT_lower(const T* k, unsigned int n, const T& d) {
+	unsigned int l = 0, h;
+	while (n) {
+		h = n >> 1;
+		if (k[l+h] < d) {
+			l += h+1;
+			n -= h+1;
+		} else n = h;
+	}
+	return l;
+}
+
+
+/* Index of the first key greater than d, that is the child to descend into */
+template <class T, unsigned int P>
+unsigned int PT<T, P>::PT_upper(const T* k, unsigned int n, const T& d) {
+	unsigned int l = 0, h;
+	while (n) {
+		h = n >> 1;
+		if (!(d < k[l+h])) {
+			l += h+1;
+			n -= h+1;
+		} else n = h;
+	}
+	return l;
+}
+
+
+/* Opens or creates the file; a temporary one is unlinked right away */
+template <class T, unsigned int P>
+void PT<T, P>::PT_open(const char* name, bool temp) {
+	char buf[P];
+	meta *m = reinterpret_cast<meta*>(buf);
+	struct stat st;
+	if (temp) {
+		const char *dir = getenv("TMPDIR");
+		std::string s = std::string(dir && *dir ? dir : "/tmp")+"/paged-tree.XXXXXX";
+		fd = mkstemp(&s[0]);
+		if (fd >= 0) unlink(s.c_str());
+	} else fd = open(name, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) throw std::runtime_error("PT: cannot open the page file");
+	if (fstat(fd, &st) || st.st_size < (off_t)P) {
+		root = height = size_var = free_var = 0;
+		pages_var = 1;
+		return;
+	}
+	PT_read(0, buf);
+	if (memcmp(m->magic, "PTREE01", 8) || m->page_size != P || m->key_size != sizeof(T)) {
+		close(fd);
+		throw std::runtime_error("PT: not a page file of this tree");
+	}
+	root = m->root;
+	height = m->height;
+	size_var = m->size;
+	pages_var = m->pages;
+	free_var = m->free;
+}
+
+
+template <class T, unsigned int P>
+void PT<T, P>::PT_alloc(unsigned int n) {
+	frames_var = n < 8 ? 8 : n;
+	pool = 0;
+	try {
+		pool = new char[(size_t)frames_var*P];
+		frames = new frame[frames_var];
+	} catch (...) {
+		delete[] pool;
+		close(fd);
+		throw;
+	}
+	lru = mru = NONE;
+	for (unsigned int i = 0 ; i < frames_var ; i++) {
+		frames[i].page = 0;
+		frames[i].pins = 0;
+		frames[i].dirty = false;
+		PT_push(i);
+	}
+}
+
+
+template <class T, unsigned int P>
+void PT<T, P>::PT_read(unsigned long long pg, char* p) {
+	size_t done = 0;
+	ssize_t r;
+	while (done < P) {
+		r = pread(fd, p+done, P-done, (off_t)(pg*P+done));
+		if (r < 0) throw std::runtime_error("PT: read failed");
+		if (!r) {
+			memset(p+done, 0, P-done);
+			break;
+		}
+		done += r;
+	}
+	reads_var++;
+}
+
+
+template <class T, unsigned int P>
+void PT<T, P>::PT_write(unsigned long long pg, const char* p) {
+	size_t done = 0;
+	ssize_t r;
+	while (done < P) {
+		r = pwrite(fd, p+done, P-done, (off_t)(pg*P+done));
+		if (r <= 0) throw std::runtime_error("PT: write failed");
+		done += r;
+	}
+	writes_var++;
+}
+
+
+template <class T, unsigned int P>
+inline char* PT<T, P>::PT_data(unsigned int f) const {
+	return pool+(size_t)f*P;
+}
+
+
+/* The frames form a list from the least (lru) to the most (mru) recently used */
+template <class T, unsigned int P>
+void PT<T, P>::PT_unlink(unsigned int f) {
+	if (frames[f].prev != NONE) frames[frames[f].prev].next = frames[f].next;
+	else lru = frames[f].next;
+	if (frames[f].next != NONE) frames[frames[f].next].prev = frames[f].prev;
+	else mru = frames[f].prev;
+}
+
+
+template <class T, unsigned int P>
+void PT<T, P>::PT_push(unsigned int f) {
+	frames[f].prev = mru;
+	frames[f].next = NONE;
+	if (mru != NONE) frames[mru].next = f;
+	else lru = f;
+	mru = f;
+}
+
+
+/* Pins page pg in a frame, reading it in unless load is false (a new page) */
+template <class T, unsigned int P>
+unsigned int PT<T, P>::PT_pin(unsigned long long pg, bool load) {
+	std::unordered_map<unsigned long long, unsigned int>::iterator i = table.find(pg);
+	unsigned int f;
+	if (i != table.end()) f = i->second;
+	else {
+		for (f = lru ; f != NONE && frames[f].pins ; f = frames[f].next) ;
+		if (f == NONE) throw std::runtime_error("PT: every frame is pinned");
+		if (frames[f].dirty) PT_write(frames[f].page, PT_data(f));
+		frames[f].dirty = false;
+		if (frames[f].page) table.erase(frames[f].page);
+		frames[f].page = 0;
+		if (load) PT_read(pg, PT_data(f));
+		else memset(PT_data(f), 0, P);
+		table[pg] = f;
+		frames[f].page = pg;
+	}
+	frames[f].pins++;
+	PT_unlink(f);
+	PT_push(f);
+	return f;
+}
+
+
+template <class T, unsigned int P>
+inline void PT<T, P>::PT_unpin(unsigned int f, bool dirty) {
+	frames[f].pins--;
+	frames[f].dirty |= dirty;
+}
+
+
+/* Pins a fresh page, off the free list or at the end of the file */
+template <class T, unsigned int P>
+unsigned int PT<T, P>::PT_new(unsigned long long& pg) {
+	unsigned int f;
+	if (free_var) {
+		f = PT_pin(free_var);
+		pg = free_var;
+		free_var = H(PT_data(f))->next;
+		memset(PT_data(f), 0, P);
+	} else {
+		f = PT_pin(pages_var, false);
+		pg = pages_var++;
+	}
+	frames[f].dirty = true;
+	return f;
+}
+
+
+/* Puts the page of the pinned frame f on the free list and unpins it */
+template <class T, unsigned int P>
+void PT<T, P>::PT_free(unsigned int f) {
+	H(PT_data(f))->count = 0;
+	H(PT_data(f))->next = free_var;
+	free_var = frames[f].page;
+	PT_unpin(f, true);
+}
+
+
+/* Forgets every frame without writing it */
+template <class T, unsigned int P>
+void PT<T, P>::PT_drop(void) {
+	for (unsigned int i = 0 ; i < frames_var ; i++) {
+		frames[i].page = 0;
+		frames[i].dirty = false;
+	}
+	table.clear();
+}
+
+
+/*
+ * Inserts d under page pg at level h (0 for a leaf). Returns 0 if d was
+ * already there, 1 if it was inserted and 2 if the page also had to be
+ * split; then sep and right are the separator and the new right page.
+ * A page is unpinned before descending, so that only a few are pinned
+ * at any time whatever the height.
+ */
+template <class T, unsigned int P>
+int PT<T, P>::PT_insert(unsigned long long pg, unsigned long long h, const T& d,
+                        T& sep, unsigned long long& right) {
+	unsigned int f = PT_pin(pg), g, i, n, m;
+	char *p = PT_data(f), *q;
+	if (!h) {
+		n = H(p)->count;
+		i = PT_lower(K(p), n, d);
+		if (i < n && K(p)[i] == d) {
+			PT_unpin(f);
+			return 0;
+		}
+		if (n < LEAF_KEYS) {
+			memmove(K(p)+i+1, K(p)+i, (n-i)*sizeof(T));
+			K(p)[i] = d;
+			H(p)->count++;
+			PT_unpin(f, true);
+			return 1;
+		}
+		try {
+			g = PT_new(right);
+		} catch (...) {
+			PT_unpin(f);
+			throw;
+		}
+		q = PT_data(g);
+		m = n/2;
+		H(q)->leaf = 1;
+		H(q)->count = n-m;
+		H(q)->next = H(p)->next;
+		memcpy(K(q), K(p)+m, (n-m)*sizeof(T));
+		H(p)->count = m;
+		H(p)->next = right;
+		if (i > m) {
+			p = q;
+			i -= m;
+		}
+		memmove(K(p)+i+1, K(p)+i, (H(p)->count-i)*sizeof(T));
+		K(p)[i] = d;
+		H(p)->count++;
+		sep = K(q)[0];
+		PT_unpin(g, true);
+		PT_unpin(f, true);
+		return 2;
+	}
+	i = PT_upper(S(p), H(p)->count, d);
+	unsigned long long child = C(p)[i];
+	PT_unpin(f);
+	T s;
+	unsigned long long r;
+	int c = PT_insert(child, h-1, d, s, r);
+	if (c != 2) return c;
+	f = PT_pin(pg);
+	p = PT_data(f);
+	n = H(p)->count;
+	if (n < INNER_KEYS) {
+		memmove(S(p)+i+1, S(p)+i, (n-i)*sizeof(T));
+		memmove(C(p)+i+2, C(p)+i+1, (n-i)*sizeof(unsigned long long));
+		S(p)[i] = s;
+		C(p)[i+1] = r;
+		H(p)->count++;
+		PT_unpin(f, true);
+		return 1;
+	}
+	try {
+		g = PT_new(right);
+	} catch (...) {
+		PT_unpin(f);
+		throw;
+	}
+	q = PT_data(g);
+	m = n/2;
+	sep = S(p)[m];
+	H(q)->leaf = 0;
+	H(q)->count = n-m-1;
+	memcpy(S(q), S(p)+m+1, (n-m-1)*sizeof(T));
+	memcpy(C(q), C(p)+m+1, (n-m)*sizeof(unsigned long long));
+	H(p)->count = m;
+	if (i > m) {
+		p = q;
+		i -= m+1;
+	}
+	n = H(p)->count;
+	memmove(S(p)+i+1, S(p)+i, (n-i)*sizeof(T));
+	memmove(C(p)+i+2, C(p)+i+1, (n-i)*sizeof(unsigned long long));
+	S(p)[i] = s;
+	C(p)[i+1] = r;
+	H(p)->count++;
+	PT_unpin(g, true);
+	PT_unpin(f, true);
+	return 2;
+}
+
+
+/*
+ * Removes d under page pg at level h. Returns 0 if d was not there, 1 if
+ * it was removed and 2 if the page is left under half full.
+ */
+template <class T, unsigned int P>
+int PT<T, P>::PT_extract(unsigned long long pg, unsigned long long h, const T& d) {
+	unsigned int f = PT_pin(pg), i, n;
+	char *p = PT_data(f);
+	n = H(p)->count;
+	if (!h) {
+		i = PT_lower(K(p), n, d);
+		if (i == n || !(K(p)[i] == d)) {
+			PT_unpin(f);
+			return 0;
+		}
+		memmove(K(p)+i, K(p)+i+1, (n-i-1)*sizeof(T));
+		H(p)->count--;
+		PT_unpin(f, true);
+		return n-1 < LEAF_KEYS/2 ? 2 : 1;
+	}
+	i = PT_upper(S(p), n, d);
+	unsigned long long g = C(p)[i];
+	PT_unpin(f);
+	int c = PT_extract(g, h-1, d);
+	if (c != 2) return c;
+	f = PT_pin(pg);
+	bool r;
+	try {
+		r = PT_fix(f, i, h == 1);
+	} catch (...) {
+		PT_unpin(f, true);
+		throw;
+	}
+	PT_unpin(f, true);
+	return r ? 2 : 1;
+}
+
+
+/*
+ * Child i of the pinned internal page f is under half full: borrows an
+ * entry from a sibling that can spare one, or else merges the two and
+ * drops their separator. Returns whether f is left under half full.
+ */
+template <class T, unsigned int P>
+bool PT<T, P>::PT_fix(unsigned int f, unsigned int i, bool leaves) {
+	char *p = PT_data(f), *l, *r;
+	unsigned int s = i ? i-1 : i, a, b, ln, rn, n = H(p)->count;
+	unsigned int half = leaves ? LEAF_KEYS/2 : INNER_KEYS/2;
+	a = PT_pin(C(p)[s]);
+	try {
+		b = PT_pin(C(p)[s+1]);
+	} catch (...) {
+		PT_unpin(a);
+		throw;
+	}
+	l = PT_data(a);
+	r = PT_data(b);
+	ln = H(l)->count;
+	rn = H(r)->count;
+	if ((s == i ? rn : ln) > half) {
+		if (leaves && s == i) {
+			K(l)[ln] = K(r)[0];
+			memmove(K(r), K(r)+1, (rn-1)*sizeof(T));
+			S(p)[s] = K(r)[0];
+		} else if (leaves) {
+			memmove(K(r)+1, K(r), rn*sizeof(T));
+			K(r)[0] = K(l)[ln-1];
+			S(p)[s] = K(r)[0];
+		} else if (s == i) {
+			S(l)[ln] = S(p)[s];
+			C(l)[ln+1] = C(r)[0];
+			S(p)[s] = S(r)[0];
+			memmove(S(r), S(r)+1, (rn-1)*sizeof(T));
+			memmove(C(r), C(r)+1, rn*sizeof(unsigned long long));
+		} else {
+			memmove(S(r)+1, S(r), rn*sizeof(T));
+			memmove(C(r)+1, C(r), (rn+1)*sizeof(unsigned long long));
+			S(r)[0] = S(p)[s];
+			C(r)[0] = C(l)[ln];
+			S(p)[s] = S(l)[ln-1];
+		}
+		H(l)->count += s == i ? 1 : -1;
+		H(r)->count += s == i ? -1 : 1;
+		PT_unpin(b, true);
+		PT_unpin(a, true);
+		return false;
+	}
+	if (leaves) {
+		memcpy(K(l)+ln, K(r), rn*sizeof(T));
+		H(l)->count = ln+rn;
+		H(l)->next = H(r)->next;
+	} else {
+		S(l)[ln] = S(p)[s];
+		memcpy(S(l)+ln+1, S(r), rn*sizeof(T));
+		memcpy(C(l)+ln+1, C(r), (rn+1)*sizeof(unsigned long long));
+		H(l)->count = ln+rn+1;
+	}
+	memmove(S(p)+s, S(p)+s+1, (n-s-1)*sizeof(T));
+	memmove(C(p)+s+1, C(p)+s+2, (n-s-1)*sizeof(unsigned long long));
+	H(p)->count--;
+	PT_free(b);
+	PT_unpin(a, true);
+	return n-1 < INNER_KEYS/2;
+}
+
+
+/* A tree in an anonymous temporary file, gone once the tree is destroyed */
+template <class T, unsigned int P>
+PT<T, P>::PT(unsigned int n):
+	reads_var(0), writes_var(0) {
+	PT_open(0, true);
+	PT_alloc(n);
+}
+
+
+/* Opens the tree kept in the named file, or starts one there; n is the number of frames */
+template <class T, unsigned int P>
+PT<T, P>::PT(const char* name, unsigned int n):
+	reads_var(0), writes_var(0) {
+	PT_open(name, false);
+	PT_alloc(n);
+}
+
+
+template <class T, unsigned int P>
+PT<T, P>::~PT(void) {
+	try {
+		flush();
+	} catch (...) {}
+	delete[] frames;
+	delete[] pool;
+	close(fd);
+}
+
+
+template <class T, unsigned int P>
+bool PT<T, P>::empty(void) const {
+	return size_var == 0;
+}
+
+
+template <class T, unsigned int P>
+unsigned long long PT<T, P>::size(void) const {
+	return size_var;
+}
+
+
+/* Pages in the file, the header and the free ones included */
+template <class T, unsigned int P>
+unsigned long long PT<T, P>::pages(void) const {
+	return pages_var;
+}
+
+
+template <class T, unsigned int P>
+unsigned long long PT<T, P>::reads(void) const {
+	return reads_var;
+}
+
+
+template <class T, unsigned int P>
+unsigned long long PT<T, P>::writes(void) const {
+	return writes_var;
+}
+
+
+template <class T, unsigned int P>
+PT<T, P>& PT<T, P>::clear(void) {
+	PT_drop();
+	root = height = size_var = free_var = 0;
+	pages_var = 1;
+	if (ftruncate(fd, P)) throw std::runtime_error("PT: truncate failed");
+	return flush();
+}
+
+
+/* Writes back every dirty page and the header */
+template <class T, unsigned int P>
+PT<T, P>& PT<T, P>::flush(void) {
+	char buf[P];
+	meta *m = reinterpret_cast<meta*>(buf);
+	for (unsigned int i = 0 ; i < frames_var ; i++)
+		if (frames[i].dirty) {
+			PT_write(frames[i].page, PT_data(i));
+			frames[i].dirty = false;
+		}
+	memset(buf, 0, P);
+	memcpy(m->magic, "PTREE01", 8);
+	m->page_size = P;
+	m->key_size = sizeof(T);
+	m->root = root;
+	m->height = height;
+	m->size = size_var;
+	m->pages = pages_var;
+	m->free = free_var;
+	PT_write(0, buf);
+	return *this;
+}
+
+
+template <class T, unsigned int P>
+bool PT<T, P>::find(const T& d) {
+	unsigned long long pg = root, h = height;
+	unsigned int f, i;
+	char *p;
+	bool r;
+	if (!root) return false;
+	for (;;) {
+		f = PT_pin(pg);
+		p = PT_data(f);
+		if (!h) break;
+		pg = C(p)[PT_upper(S(p), H(p)->count, d)];
+		PT_unpin(f);
+		h--;
+	}
+	i = PT_lower(K(p), H(p)->count, d);
+	r = i < H(p)->count && K(p)[i] == d;
+	PT_unpin(f);
+	return r;
+}
+
+
+template <class T, unsigned int P>
+PT<T, P>& PT<T, P>::insert(const T& d) {
+	unsigned long long r, pg;
+	unsigned int f;
+	char *p;
+	T s;
+	if (!root) {
+		f = PT_new(pg);
+		p = PT_data(f);
+		H(p)->leaf = 1;
+		H(p)->count = 1;
+		K(p)[0] = d;
+		PT_unpin(f, true);
+		root = pg;
+		height = 0;
+		size_var++;
+		return *this;
+	}
+	int c = PT_insert(root, height, d, s, r);
+	if (c) size_var++;
+	if (c == 2) {
+		f = PT_new(pg);
+		p = PT_data(f);
+		H(p)->leaf = 0;
+		H(p)->count = 1;
+		S(p)[0] = s;
+		C(p)[0] = root;
+		C(p)[1] = r;
+		PT_unpin(f, true);
+		root = pg;
+		height++;
+	}
+	return *this;
+}
+
+
+template <class T, unsigned int P>
+PT<T, P>& PT<T, P>::extract(const T& d) {
+	unsigned int f;
+	char *p;
+	if (!root || !PT_extract(root, height, d)) return *this;
+	size_var--;
+	f = PT_pin(root);
+	p = PT_data(f);
+	if (H(p)->count) PT_unpin(f);
+	else if (height) {
+		unsigned long long c = C(p)[0];
+		PT_free(f);
+		root = c;
+		height--;
+	} else {
+		PT_free(f);
+		root = 0;
+	}
+	return *this;
+}
+
+
+/* Visits the keys in order along the chain of leaves */
+template <class T, unsigned int P>
+template <class F>
+void PT<T, P>::for_each(F fn) {
+	unsigned long long pg = root, h = height;
+	unsigned int f, i, n;
+	char *p;
+	if (!root) return;
+	for (; h ; h--) {
+		f = PT_pin(pg);
+		pg = C(PT_data(f))[0];
+		PT_unpin(f);
+	}
+	while (pg) {
+		f = PT_pin(pg);
+		p = PT_data(f);
+		n = H(p)->count;
+		try {
+			for (i = 0 ; i < n ; i++)
+				fn(K(p)[i]);
+		} catch (...) {
+			PT_unpin(f);
+			throw;
+		}
+		pg = H(p)->next;
+		PT_unpin(f);
+	}
+}
+
+
+template <class T>
+struct PT_printer {
+	void operator()(const T& d) const { std::cout << d << ' '; }
+};
+
+
+template <class T, unsigned int P>
+void PT<T, P>::print(void) {
+	for_each(PT_printer<T>());
+	std::cout << std::endl;
+}
+
+
+
+/* Testing main */
+
+#ifndef NO_TESTING_MAIN
+
+#include <ctime>
+#include <cstdio>
+#include "perf-counters.h"
+using namespace std;
+
+
+int main(int argc, char **argv)
+{
+	int i, j, n;
+	double t;
+	PERF perf;
+	if (argc > 3) return EXIT_FAILURE;
+	i = time(0);
+	if (argc == 1) n = 20;
+	else {
+		n = atoi(argv[1]);
+		if (argc == 3) i = atoi(argv[2]);
+	}
+	srand((unsigned int)i);
+	cout << "Size is " << n << endl;
+	cout << "Seed is " << i << endl;
+	{
+		PT<int> tree("paged-tree.dat", 256);
+		tree.clear();
+		cout << "Inserting..." << endl;
+		t = ((double)clock())/CLOCKS_PER_SEC;
+		perf.start();
+		for (i = 1 ; i <= n ; i++) {
+			j = rand()%n+1;
+		//	cout << j << ' ';
+			tree.insert(j);
+		}
+		perf.stop();
+		t = ((double)clock())/CLOCKS_PER_SEC-t;
+		cout << t << " secs" << endl;
+		perf.report(n);
+	//	cout << "\nPrinting tree..." << endl;
+	//	tree.print();
+		cout << "Size of tree is: " << tree.size() << endl;
+		cout << "Pages in file: " << tree.pages() << ", read " << tree.reads()
+		     << ", written " << tree.writes() << endl;
+		cout << "Looking up..." << endl;
+		t = ((double)clock())/CLOCKS_PER_SEC;
+		perf.start();
+		for (i = j = 0 ; i < n ; i++)
+			j += tree.find(rand()%n+1);
+		perf.stop();
+		t = ((double)clock())/CLOCKS_PER_SEC-t;
+		cout << t << " secs, " << j << " found" << endl;
+		perf.report(n);
+		cout << "Extracting..." << endl;
+		t = ((double)clock())/CLOCKS_PER_SEC;
+		perf.start();
+		for (i = 1 ; i <= n ; i++) {
+			j = rand()%n+1;
+		//	cout << j << ' ';
+			tree.extract(j);
+		}
+		perf.stop();
+		t = ((double)clock())/CLOCKS_PER_SEC-t;
+		cout << t << " secs" << endl;
+		perf.report(n);
+	//	cout << "\nPrinting tree..." << endl;
+	//	tree.print();
+		cout << "Size of tree is: " << tree.size() << endl;
+		cout << "Pages in file: " << tree.pages() << ", read " << tree.reads()
+		     << ", written " << tree.writes() << endl;
+		cout << "Clearing..." << endl;
+		t = ((double)clock())/CLOCKS_PER_SEC;
+		perf.start();
+		tree.clear();
+		perf.stop();
+		t = ((double)clock())/CLOCKS_PER_SEC-t;
+		cout << t << " secs" << endl;
+		perf.report(n);
+	}
+	remove("paged-tree.dat");
+	return EXIT_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,299 @@
+/*
+ * C++ Parallel traversal of the trees with work stealing
+ * Written by orestisp
+ * std06176@di.uoa.gr
+ */
+
+
+
+#ifndef PARALLEL_TRAVERSAL_H
+#define PARALLEL_TRAVERSAL_H
+
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <atomic>
+
+
+/* Subtrees of about this many nodes are walked by one thread */
+enum { PAR_GRAIN = 4096 };
+
+
+template <class N>
+struct PAR_task {
+	N *p;
+	unsigned int depth;
+};
+
+
+/*
+ * Visits every node of a binary tree (anything with data, left and right)
+ * with one visitor per thread, in no particular order. The tree is cut
+ * into tasks at subtree boundaries: down to depth split a node hands its
+ * right subtree to a task and goes on with its left one, and below that
+ * a subtree is walked sequentially with an explicit stack, so degenerate
+ * trees do not overflow the call stack. Each thread takes tasks from the
+ * back of its own deque and, when that is empty, steals from the front
+ * of the others', where the biggest subtrees are. The walk is over when
+ * no task is pending. If a visitor throws, every thread stops after its
+ * current task and run rethrows the first exception once all have
+ * finished.
+ */
+
+template <class N, class V>
+class PAR_WALK {
+	private:
+		struct queue {
+			std::mutex lock;
+			std::deque<PAR_task<N> > tasks;
+			std::vector<N*> stack;
+		};
+		std::vector<queue> queues;
+		std::vector<V>& visitors;
+		std::atomic<unsigned long long> pending;
+		std::atomic<bool> stop;
+		std::vector<std::exception_ptr> errors;
+		unsigned int split;
+		void PAR_push(unsigned int, N*, unsigned int);
+		bool PAR_take(unsigned int, PAR_task<N>&);
+		void PAR_visit(unsigned int, N*, unsigned int);
+		void PAR_work(unsigned int);
+	public:
+		PAR_WALK(std::vector<V>&, unsigned long long, unsigned int);
+		void run(N*);
+};
+
+
+template <class N, class V>
+void PAR_WALK<N, V>::PAR_push(unsigned int i, N* p, unsigned int d) {
+	PAR_task<N> t;
+	t.p = p;
+	t.depth = d;
+	pending++;
+	std::lock_guard<std::mutex> g(queues[i].lock);
+	queues[i].tasks.push_back(t);
+}
+
+
+template <class N, class V>
+bool PAR_WALK<N, V>::PAR_take(unsigned int i, PAR_task<N>& t) {
+	{
+		std::lock_guard<std::mutex> g(queues[i].lock);
+		if (!queues[i].tasks.empty()) {
+			t = queues[i].tasks.back();
+			queues[i].tasks.pop_back();
+			return true;
+		}
+	}
+	for (unsigned int j = (i+1)%queues.size() ; j != i ; j = (j+1)%queues.size()) {
+		std::lock_guard<std::mutex> g(queues[j].lock);
+		if (!queues[j].tasks.empty()) {
+			t = queues[j].tasks.front();
+			queues[j].tasks.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
+
+
+template <class N, class V>
+void PAR_WALK<N, V>::PAR_visit(unsigned int i, N* p, unsigned int d) {
+	V& v = visitors[i];
+	std::vector<N*>& s = queues[i].stack;
+	for (; p && d < split ; p = p->left, d++) {
+		if (p->right) PAR_push(i, p->right, d+1);
+		v(p->data);
+	}
+	if (p) s.push_back(p);
+	while (!s.empty()) {
+		p = s.back();
+		s.pop_back();
+		v(p->data);
+		if (p->left) s.push_back(p->left);
+		if (p->right) s.push_back(p->right);
+	}
+}
+
+
+template <class N, class V>
+void PAR_WALK<N, V>::PAR_work(unsigned int i) {
+	PAR_task<N> t;
+	try {
+		while (pending && !stop)
+			if (PAR_take(i, t)) {
+				PAR_visit(i, t.p, t.depth);
+				pending--;
+			} else std::this_thread::yield();
+	} catch (...) {
+		errors[i] = std::current_exception();
+		stop = true;
+	}
+}
+
+
+/* One thread per visitor; n nodes are cut in tasks of about grain nodes */
+template <class N, class V>
+PAR_WALK<N, V>::PAR_WALK(std::vector<V>& v, unsigned long long n, unsigned int grain):
+	queues(v.size()), visitors(v), pending(0), stop(false), errors(v.size()), split(0) {
+	if (v.size() < 2) return;
+	while (split < 48 && (n >> split) > grain) split++;
+	while (split < 32 && (1u << split) < 4*v.size()) split++;
+}
+
+
+template <class N, class V>
+void PAR_WALK<N, V>::run(N* root) {
+	std::vector<std::thread> w;
+	if (!root) return;
+	w.reserve(queues.size());
+	PAR_push(0, root, 0);
+	try {
+		while (w.size()+1 < queues.size()) {
+			unsigned int i = w.size()+1;
+			w.push_back(std::thread([this, i]() { PAR_work(i); }));
+		}
+	} catch (...) {}
+	PAR_work(0);
+	for (unsigned int i = 0 ; i < w.size() ; i++)
+		w[i].join();
+	for (unsigned int i = 0 ; i < errors.size() ; i++)
+		if (errors[i]) std::rethrow_exception(errors[i]);
+}
+
+
+template <class F>
+struct PAR_apply {
+	F *f;
+	template <class D> void operator()(const D& d) { (*f)(d); }
+};
+
+
+template <class R, class M, class C>
+struct PAR_fold {
+	R acc;
+	bool any;
+	M *map;
+	C *combine;
+	PAR_fold(const R& r, M* m, C* c): acc(r), any(false), map(m), combine(c) {}
+	template <class D> void operator()(const D& d) {
+		if (any) acc = (*combine)(acc, (*map)(d));
+		else {
+			acc = (*map)(d);
+			any = true;
+		}
+	}
+};
+
+
+static inline unsigned int PAR_threads(unsigned int threads, unsigned long long n) {
+	if (!threads) threads = std::thread::hardware_concurrency();
+	if (!threads || n <= PAR_GRAIN) threads = 1;
+	return threads;
+}
+
+
+/*
+ * Calls f on every key of the tree from several threads at once; f must
+ * be thread safe. The first exception it throws is rethrown once every
+ * thread has stopped.
+ */
+template <class N, class F>
+void PAR_for_each(N* root, unsigned long long n, F& f, unsigned int threads) {
+	PAR_apply<F> a;
+	a.f = &f;
+	std::vector<PAR_apply<F> > v(PAR_threads(threads, n), a);
+	PAR_WALK<N, PAR_apply<F> >(v, n, PAR_GRAIN).run(root);
+}
+
+
+/*
+ * combine(init, map(k)) over every key k, in any order and grouping, so
+ * combine must be associative and commutative. Each thread folds its
+ * own keys and the partial results are combined into init at the end.
+ */
+template <class N, class R, class M, class C>
+R PAR_reduce(N* root, unsigned long long n, const R& init, M& map, C& combine,
+             unsigned int threads) {
+	std::vector<PAR_fold<R, M, C> > v(PAR_threads(threads, n),
+	                                  PAR_fold<R, M, C>(init, &map, &combine));
+	R r = init;
+	PAR_WALK<N, PAR_fold<R, M, C> >(v, n, PAR_GRAIN).run(root);
+	for (unsigned int i = 0 ; i < v.size() ; i++)
+		if (v[i].any) r = combine(r, v[i].acc);
+	return r;
+}
+
+
+/*
+ * Runs f(0) .. f(n-1) on n threads, f(0) on the calling one and the
+ * rest there too if no thread can be started. Rethrows the first
+ * exception thrown once all have finished.
+ */
+template <class F>
+void PAR_run(unsigned int n, F f) {
+	std::vector<std::thread> w;
+	std::vector<std::exception_ptr> e(n);
+	auto g = [&](unsigned int i) {
+		try {
+			f(i);
+		} catch (...) {
+			e[i] = std::current_exception();
+		}
+	};
+	unsigned int i;
+	w.reserve(n);
+	try {
+		for (i = 1 ; i < n ; i++)
+			w.push_back(std::thread(g, i));
+	} catch (...) {}
+	for (i = w.size()+1 ; i < n ; i++)
+		g(i);
+	g(0);
+	for (i = 0 ; i < w.size() ; i++)
+		w[i].join();
+	for (i = 0 ; i < n ; i++)
+		if (e[i]) std::rethrow_exception(e[i]);
+}
+
+
+/*
+ * Sorts v and removes duplicate keys with up to threads threads: each
+ * sorts a slice, the slices are merged pairwise in parallel rounds and
+ * then each slice drops its duplicates, including those of the key
+ * before it, and the gaps are closed at the end.
+ */
+template <class T>
+void PAR_sort_unique(std::vector<T>& v, unsigned int threads) {
+	unsigned int n = PAR_threads(threads, v.size()), i, w;
+	std::vector<size_t> b(n+1), k(n), skip(n);
+	typename std::vector<T>::iterator s = v.begin();
+	for (i = 0 ; i <= n ; i++)
+		b[i] = v.size()*i/n;
+	PAR_run(n, [&](unsigned int j) {
+		std::sort(s+b[j], s+b[j+1]);
+	});
+	for (w = 1 ; w < n ; w *= 2)
+		PAR_run((n-w+2*w-1)/(2*w), [&](unsigned int j) {
+			j *= 2*w;
+			std::inplace_merge(s+b[j], s+b[j+w], s+b[std::min(j+2*w, n)]);
+		});
+	PAR_run(n, [&](unsigned int j) {
+		if (j)
+			while (b[j]+skip[j] < b[j+1] && !(v[b[j]-1] < v[b[j]+skip[j]])) skip[j]++;
+	});
+	PAR_run(n, [&](unsigned int j) {
+		k[j] = std::unique(s+b[j]+skip[j], s+b[j+1])-(s+b[j]);
+	});
+	size_t m = k[0];
+	for (i = 1 ; i < n ; i++) {
+		if (m != b[i]+skip[i]) std::move(s+b[i]+skip[i], s+b[i]+k[i], s+m);
+		m += k[i]-skip[i];
+	}
+	v.erase(s+m, v.end());
+}
+
+#endif
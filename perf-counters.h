@@ -0,0 +1,158 @@
+/*
+ * C++ Hardware performance counters for the testing mains
+ * Written by orestisp
+ * std06176@di.uoa.gr
+ */
+
+
+
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <iostream>
+
+#if defined(__linux__) && !defined(NO_PERF_COUNTERS)
+#include <cstring>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#define PERF_LINUX
+#endif
+
+
+/*
+ * Counts instructions, cache misses, branch misses and data TLB misses of
+ * the calling thread between start() and stop(), through perf_event_open.
+ * Each counter is opened on its own, so a missing one does not take the
+ * others with it; counters the kernel multiplexed are scaled up by the
+ * time they were enabled over the time they ran. Where nothing can be
+ * opened (other systems, containers, perf_event_paranoid) report() prints
+ * nothing. Define NO_PERF_COUNTERS to leave them out altogether.
+ */
+
+class PERF {
+	public:
+		enum { INSTRUCTIONS, CACHE_MISSES, BRANCH_MISSES, TLB_MISSES, COUNTERS };
+	private:
+		int fd[COUNTERS];
+		double value[COUNTERS];
+		PERF(const PERF&);
+		PERF& operator=(const PERF&);
+		static const char* PERF_name(int);
+	public:
+		PERF(void);
+		~PERF(void);
+		bool available(void) const;
+		bool has(int) const;
+		double get(int) const;
+		void start(void);
+		void stop(void);
+		void report(unsigned long long, std::ostream& = std::cout) const;
+};
+
+
+inline const char* PERF::PERF_name(int i) {
+	static const char* names[COUNTERS] = {
+		"instructions", "cache misses", "branch misses", "dTLB misses"
+	};
+	return names[i];
+}
+
+
+inline PERF::PERF(void) {
+	for (int i = 0 ; i < COUNTERS ; i++) {
+		fd[i] = -1;
+		value[i] = 0;
+	}
+#ifdef PERF_LINUX
+	static const unsigned int type[COUNTERS] = {
+		PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+		PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE
+	};
+	static const unsigned long long config[COUNTERS] = {
+		PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES,
+		PERF_COUNT_HW_BRANCH_MISSES,
+		PERF_COUNT_HW_CACHE_DTLB | PERF_COUNT_HW_CACHE_OP_READ << 8 |
+			PERF_COUNT_HW_CACHE_RESULT_MISS << 16
+	};
+	for (int i = 0 ; i < COUNTERS ; i++) {
+		struct perf_event_attr a;
+		memset(&a, 0, sizeof(a));
+		a.size = sizeof(a);
+		a.type = type[i];
+		a.config = config[i];
+		a.disabled = 1;
+		a.exclude_kernel = 1;
+		a.exclude_hv = 1;
+		a.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		fd[i] = syscall(__NR_perf_event_open, &a, 0, -1, -1, 0);
+	}
+#endif
+}
+
+
+inline PERF::~PERF(void) {
+#ifdef PERF_LINUX
+	for (int i = 0 ; i < COUNTERS ; i++)
+		if (fd[i] >= 0) close(fd[i]);
+#endif
+}
+
+
+inline bool PERF::available(void) const {
+	for (int i = 0 ; i < COUNTERS ; i++)
+		if (fd[i] >= 0) return true;
+	return false;
+}
+
+
+inline bool PERF::has(int i) const {
+	return fd[i] >= 0;
+}
+
+
+/* Count of the last start()/stop() interval, 0 if the counter is missing */
+inline double PERF::get(int i) const {
+	return value[i];
+}
+
+
+inline void PERF::start(void) {
+#ifdef PERF_LINUX
+	for (int i = 0 ; i < COUNTERS ; i++)
+		if (fd[i] >= 0) {
+			ioctl(fd[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(fd[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+#endif
+}
+
+
+inline void PERF::stop(void) {
+#ifdef PERF_LINUX
+	for (int i = 0 ; i < COUNTERS ; i++)
+		if (fd[i] >= 0) ioctl(fd[i], PERF_EVENT_IOC_DISABLE, 0);
+	for (int i = 0 ; i < COUNTERS ; i++) {
+		unsigned long long v[3];
+		value[i] = 0;
+		if (fd[i] < 0 || read(fd[i], v, sizeof(v)) != (ssize_t)sizeof(v)) continue;
+		value[i] = v[2] ? (double)v[0]*v[1]/v[2] : 0;
+	}
+#endif
+}
+
+
+/* Prints the counters of the last interval divided by ops */
+inline void PERF::report(unsigned long long ops, std::ostream& out) const {
+	const char *sep = "";
+	if (!available() || !ops) return;
+	for (int i = 0 ; i < COUNTERS ; i++)
+		if (fd[i] >= 0) {
+			out << sep << value[i]/ops << ' ' << PERF_name(i);
+			sep = ", ";
+		}
+	out << " per op" << std::endl;
+}
+
+#endif
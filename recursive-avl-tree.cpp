@@ -8,10 +8,23 @@
 
 #include <iostream>
 #include <fstream>
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <thread>
+#include <exception>
+#include "parallel-traversal.h"
+#include "memory-usage.h"
 
 template <class T>
 class AVL {
+	public:
+		struct batch_op {
+			T data;
+			bool insert;
+		};
 	private:
+		enum { BATCH_GRAIN = 1024 };
 		struct node {
 			T data;
 			int balance:2;
@@ -24,37 +37,91 @@ class AVL {
 		node *tnode;
 		const T* tdata;
 		unsigned int size_var;
-		void AVL_clear(node*);
+		unsigned long long limit_var;
+		unsigned int AVL_clear(node*);
 		inline void AVL_LL_rotate(node*&);
 		inline void AVL_RR_rotate(node*&);
 		inline void AVL_LR_rotate(node*&);
 		inline void AVL_RL_rotate(node*&);
 		bool AVL_insert(node*&);
 		bool AVL_delete(node*&);
+		void AVL_merge(node*, AVL&);
 		bool AVL_delmin(node*&);
+		static int AVL_height(node*);
+		static node* AVL_link(node*, int, node*, node*, int, int&);
+		static node* AVL_join_right(node*, int, node*, node*, int, int&);
+		static node* AVL_join_left(node*, int, node*, node*, int, int&);
+		static node* AVL_join(node*, int, node*, node*, int, int&);
+		static node* AVL_split_last(node*, int, node*&, int&);
+		static node* AVL_join2(node*, int, node*, int, int&);
+		static node* AVL_split(node*, int, const T&, bool, node*&, int&, int&);
+		static node* AVL_build(node**, unsigned int, int&);
+		static node* AVL_build(node**, unsigned int, int&, unsigned int);
+		static node* AVL_build(node*&, unsigned int, int&);
+		void AVL_rebuild(void);
+		static node* AVL_batch(node*, int, const batch_op**, node**,
+		                       unsigned int, int&, unsigned int, long&);
 		void AVL_copy(node*&, node*);
 		void AVL_print(node*) const;
 		void AVL_display(node*, std::ofstream&, unsigned int*) const;
 	public:
+		class node_handle {
+			friend class AVL<T>;
+			private:
+				node *p;
+				explicit node_handle(node* n): p(n) {}
+				node_handle(const node_handle&);
+				node_handle& operator=(const node_handle&);
+			public:
+				node_handle(void): p(0) {}
+				node_handle(node_handle&& h): p(h.p) { h.p = 0; }
+				~node_handle(void) { delete p; }
+				node_handle& operator=(node_handle&& h) {
+					if (this != &h) {
+						delete p;
+						p = h.p;
+						h.p = 0;
+					}
+					return *this;
+				}
+				bool empty(void) const { return !p; }
+				T& value(void) const { return p->data; }
+		};
 		AVL(void);
 		AVL(const AVL&);
+		AVL(AVL&&);
 		~AVL(void);
+		AVL<T>& operator=(const AVL&);
+		AVL<T>& operator=(AVL&&);
+		AVL<T>& swap(AVL&);
 		bool empty(void) const;
 		unsigned int size(void) const;
 		AVL<T>& clear(void);
 		bool find(const T&) const;
 		AVL<T>& insert(const T&);
 		AVL<T>& extract(const T&);
+		node_handle extract_node(const T&);
+		AVL<T>& insert(node_handle&&);
+		AVL<T>& merge(AVL&);
+		AVL<T>& erase_range(const T&, const T&);
+		AVL<T>& apply_batch(const std::vector<batch_op>&, unsigned int = 0);
+		template <class I> AVL<T>& build_from_unsorted(I, I, unsigned int = 0);
+		template <class F> void parallel_for_each(F, unsigned int = 0) const;
+		template <class R, class M, class C> R parallel_reduce(R, M, C, unsigned int = 0) const;
 		AVL<T>& print(void) const;
 		void display(std::ofstream&) const;
+		MEM_usage memory_usage(void) const;
+		AVL<T>& set_memory_limit(unsigned long long);
 };
 
 
 template <class T>
-void AVL<T>::AVL_clear(node* p) {
-	if (p->left) AVL_clear(p->left);
-	if (p->right) AVL_clear(p->right);
+unsigned int AVL<T>::AVL_clear(node* p) {
+	unsigned int c = 1;
+	if (p->left) c += AVL_clear(p->left);
+	if (p->right) c += AVL_clear(p->right);
 	delete p;
+	return c;
 }
 
 
@@ -119,7 +186,8 @@ inline void AVL<T>::AVL_RL_rotate(node*& p) {
 template <class T>
 bool AVL<T>::AVL_insert(node*& p) {
 	if (!p) {
-		p = new node(*tdata);
+		if (!tnode && limit_var) MEM_reserve(memory_usage(), MEM_chunk(sizeof(node)), limit_var);
+		p = tnode ? tnode : new node(*tdata);
 		size_var++;
 		return true;
 	}
@@ -181,12 +249,13 @@ bool AVL<T>::AVL_delete(node*& p) {
 	if (!p->left) p = p->right;
 	else if (!p->right) p = p->left;
 	else {
+		node *t = p;
 		bool r = AVL_delmin(p->right);
-		tnode->balance = p->balance;
-		tnode->left = p->left;
-		tnode->right = p->right;
-		delete p;
+		tnode->balance = t->balance;
+		tnode->left = t->left;
+		tnode->right = t->right;
 		p = tnode;
+		tnode = t;
 		if (!r) return false;
 		if (p->balance != -1)
 			return !--p->balance;
@@ -197,7 +266,6 @@ bool AVL<T>::AVL_delete(node*& p) {
 		AVL_LR_rotate(p);
 		return true;
 	}
-	delete tnode;
 	return true;
 }
 
@@ -222,6 +290,285 @@ bool AVL<T>::AVL_delmin(node*& p) {
 }
 
 
+/* Moves the nodes of p here, or back into param when the key is here */
+template <class T>
+void AVL<T>::AVL_merge(node* p, AVL& param) {
+	node *l = p->left, *r = p->right;
+	unsigned int n = size_var;
+	p->left = p->right = 0;
+	p->balance = 0;
+	tdata = &(p->data);
+	tnode = p;
+	AVL_insert(root);
+	if (n == size_var) {
+		param.tdata = &(p->data);
+		param.tnode = p;
+		param.AVL_insert(param.root);
+	}
+	if (l) AVL_merge(l, param);
+	if (r) AVL_merge(r, param);
+}
+
+
+template <class T>
+int AVL<T>::AVL_height(node* p) {
+	int h = 0;
+	for (; p ; h++)
+		p = p->balance == 1 ? p->right : p->left;
+	return h;
+}
+
+
+template <class T>
+typename AVL<T>::node* AVL<T>::AVL_link(node* l, int hl, node* k,
+                                        node* r, int hr, int& h) {
+	k->left = l;
+	k->right = r;
+	k->balance = hr-hl;
+	h = (hl > hr ? hl : hr)+1;
+	return k;
+}
+
+
+template <class T>
+typename AVL<T>::node* AVL<T>::AVL_join_right(node* l, int hl, node* k,
+                                              node* r, int hr, int& h) {
+	node *t, *c = l->right;
+	int hc = hl-1-(l->balance == -1), hll = hl-1-(l->balance == 1), ht;
+	if (hc <= hr+1)
+		t = AVL_link(c, hc, k, r, hr, ht);
+	else
+		t = AVL_join_right(c, hc, k, r, hr, ht);
+	if (ht <= hll+1)
+		return AVL_link(l->left, hll, l, t, ht, h);
+	int htl = ht-1-(t->balance == 1), htr = ht-1-(t->balance == -1), ha, hb;
+	if (htl <= htr) {
+		node *a = AVL_link(l->left, hll, l, t->left, htl, ha);
+		return AVL_link(a, ha, t, t->right, htr, h);
+	}
+	node *m = t->left;
+	int hml = htl-1-(m->balance == 1), hmr = htl-1-(m->balance == -1);
+	node *a = AVL_link(l->left, hll, l, m->left, hml, ha);
+	node *b = AVL_link(m->right, hmr, t, t->right, htr, hb);
+	return AVL_link(a, ha, m, b, hb, h);
+}
+
+
+template <class T>
+typename AVL<T>::node* AVL<T>::AVL_join_left(node* l, int hl, node* k,
+                                             node* r, int hr, int& h) {
+	node *t, *c = r->left;
+	int hc = hr-1-(r->balance == 1), hrr = hr-1-(r->balance == -1), ht;
+	if (hc <= hl+1)
+		t = AVL_link(l, hl, k, c, hc, ht);
+	else
+		t = AVL_join_left(l, hl, k, c, hc, ht);
+	if (ht <= hrr+1)
+		return AVL_link(t, ht, r, r->right, hrr, h);
+	int htl = ht-1-(t->balance == 1), htr = ht-1-(t->balance == -1), ha, hb;
+	if (htr <= htl) {
+		node *a = AVL_link(t->right, htr, r, r->right, hrr, ha);
+		return AVL_link(t->left, htl, t, a, ha, h);
+	}
+	node *m = t->right;
+	int hml = htr-1-(m->balance == 1), hmr = htr-1-(m->balance == -1);
+	node *a = AVL_link(t->left, htl, t, m->left, hml, ha);
+	node *b = AVL_link(m->right, hmr, r, r->right, hrr, hb);
+	return AVL_link(a, ha, m, b, hb, h);
+}
+
+
+template <class T>
+typename AVL<T>::node* AVL<T>::AVL_join(node* l, int hl, node* k,
+                                        node* r, int hr, int& h) {
+	if (hl > hr+1) return AVL_join_right(l, hl, k, r, hr, h);
+	if (hr > hl+1) return AVL_join_left(l, hl, k, r, hr, h);
+	return AVL_link(l, hl, k, r, hr, h);
+}
+
+
+template <class T>
+typename AVL<T>::node* AVL<T>::AVL_split_last(node* p, int hp,
+                                              node*& last, int& h) {
+	int hl = hp-1-(p->balance == 1), hr = hp-1-(p->balance == -1);
+	if (!p->right) {
+		last = p;
+		h = hl;
+		return p->left;
+	}
+	node *r = AVL_split_last(p->right, hr, last, hr);
+	return AVL_join(p->left, hl, p, r, hr, h);
+}
+
+
+template <class T>
+typename AVL<T>::node* AVL<T>::AVL_join2(node* l, int hl,
+                                         node* r, int hr, int& h) {
+	node *k;
+	if (!l) {
+		h = hr;
+		return r;
+	}
+	l = AVL_split_last(l, hl, k, hl);
+	return AVL_join(l, hl, k, r, hr, h);
+}
+
+
+template <class T>
+typename AVL<T>::node* AVL<T>::AVL_split(node* p, int hp, const T& k, bool incl,
+                                         node*& r, int& hl, int& hr) {
+	node *l;
+	int pl, pr, h;
+	if (!p) {
+		r = 0;
+		hl = hr = 0;
+		return 0;
+	}
+	pl = hp-1-(p->balance == 1);
+	pr = hp-1-(p->balance == -1);
+	if (p->data < k || (incl && !(k < p->data))) {
+		l = AVL_split(p->right, pr, k, incl, r, h, hr);
+		return AVL_join(p->left, pl, p, l, h, hl);
+	}
+	l = AVL_split(p->left, pl, k, incl, r, hl, h);
+	r = AVL_join(r, h, p, p->right, pr, hr);
+	return l;
+}
+
+
+template <class T>
+typename AVL<T>::node* AVL<T>::AVL_build(node** a, unsigned int n, int& h) {
+	unsigned int m = n/2;
+	int hl, hr;
+	if (!n) {
+		h = 0;
+		return 0;
+	}
+	node *l = AVL_build(a, m, hl);
+	node *r = AVL_build(a+m+1, n-m-1, hr);
+	return AVL_link(l, hl, a[m], r, hr, h);
+}
+
+
+/* As above, building the left half on another thread while par > 0 */
+template <class T>
+typename AVL<T>::node* AVL<T>::AVL_build(node** a, unsigned int n, int& h,
+                                         unsigned int par) {
+	unsigned int m = n/2;
+	int hl, hr;
+	node *l = 0, *r;
+	std::thread w;
+	if (!par || n < 2*BATCH_GRAIN) return AVL_build(a, n, h);
+	try {
+		w = std::thread([&]() { l = AVL_build(a, m, hl, par-1); });
+	} catch (...) {}
+	r = AVL_build(a+m+1, n-m-1, hr, par-1);
+	if (w.joinable()) w.join();
+	else l = AVL_build(a, m, hl, par-1);
+	return AVL_link(l, hl, a[m], r, hr, h);
+}
+
+
+template <class T>
+typename AVL<T>::node* AVL<T>::AVL_batch(node* p, int hp, const batch_op** a,
+                                         node** nn, unsigned int m, int& h,
+                                         unsigned int par, long& delta) {
+	if (!m) {
+		h = hp;
+		return p;
+	}
+	if (!p) {
+		std::vector<node*> v;
+		for (unsigned int i = 0 ; i < m ; i++)
+			if (nn[i]) v.push_back(nn[i]);
+		std::fill(nn, nn+m, (node*)0);
+		delta += v.size();
+		return AVL_build(v.empty() ? 0 : &v[0], v.size(), h);
+	}
+	const batch_op **q = std::lower_bound(a, a+m, &p->data,
+		[](const batch_op* o, const T* d) { return o->data < *d; });
+	unsigned int i = q-a, j = i;
+	bool hit = i < m && !(p->data < a[i]->data);
+	if (hit) j++;
+	int hl = hp-1-(p->balance == 1), hr = hp-1-(p->balance == -1);
+	long dl = 0, dr = 0;
+	node *l = 0, *r;
+	std::thread w;
+	std::exception_ptr e;
+	if (par && i >= BATCH_GRAIN && m-j >= BATCH_GRAIN) {
+		try {
+			w = std::thread([&]() {
+				try {
+					p->left = l = AVL_batch(p->left, hl, a, nn, i, hl, par-1, dl);
+				} catch (...) {
+					e = std::current_exception();
+				}
+			});
+		} catch (...) {}
+	}
+	try {
+		p->right = r = AVL_batch(p->right, hr, a+j, nn+j, m-j, hr, par ? par-1 : 0, dr);
+	} catch (...) {
+		if (w.joinable()) w.join();
+		throw;
+	}
+	if (w.joinable()) {
+		w.join();
+		if (e) std::rethrow_exception(e);
+	} else p->left = l = AVL_batch(p->left, hl, a, nn, i, hl, par ? par-1 : 0, dl);
+	delta += dl+dr;
+	if (hit) {
+		if (!a[i]->insert) {
+			delete p;
+			delta--;
+			return AVL_join2(l, hl, r, hr, h);
+		}
+		delete nn[i];
+		nn[i] = 0;
+	}
+	return AVL_join(l, hl, p, r, hr, h);
+}
+
+
+/* As above, taking n nodes from a list linked through right */
+template <class T>
+typename AVL<T>::node* AVL<T>::AVL_build(node*& list, unsigned int n, int& h) {
+	int hl, hr;
+	node *l, *k, *r;
+	if (!n) {
+		h = 0;
+		return 0;
+	}
+	l = AVL_build(list, n/2, hl);
+	k = list;
+	list = list->right;
+	r = AVL_build(list, n-n/2-1, hr);
+	return AVL_link(l, hl, k, r, hr, h);
+}
+
+
+/* Rebalances the whole tree in place, recounting its size, without allocating */
+template <class T>
+void AVL<T>::AVL_rebuild(void) {
+	node *p = root, *list = 0, **t = &list, *q;
+	int h;
+	size_var = 0;
+	while (p)
+		if (p->left) {
+			q = p->left;
+			p->left = q->right;
+			q->right = p;
+			p = q;
+		} else {
+			*t = p;
+			t = &p->right;
+			p = p->right;
+			size_var++;
+		}
+	root = AVL_build(list, size_var, h);
+}
+
+
 template <class T>
 void AVL<T>::AVL_copy(node*& p, node* rp) {
 	p = new node(rp->data, rp->balance);
@@ -255,12 +602,12 @@ void AVL<T>::AVL_display(node* p, std::ofstream& out, unsigned int *c) const {
 
 template <class T>
 AVL<T>::AVL(void):
-	root(0), size_var(0) {}
+	root(0), size_var(0), limit_var(0) {}
 
 
 template <class T>
 AVL<T>::AVL(const AVL& param):
-	root(0), size_var(param.size_var) {
+	root(0), size_var(param.size_var), limit_var(param.limit_var) {
 	if (param.root) {
 		try {
 			AVL_copy(root, param.root);
@@ -272,12 +619,46 @@ AVL<T>::AVL(const AVL& param):
 }
 
 
+template <class T>
+AVL<T>::AVL(AVL&& param):
+	root(param.root), size_var(param.size_var), limit_var(param.limit_var) {
+	param.root = 0;
+	param.size_var = 0;
+}
+
+
 template <class T>
 AVL<T>::~AVL(void) {
 	clear();
 }
 
 
+template <class T>
+AVL<T>& AVL<T>::operator=(const AVL& param) {
+	AVL<T> t(param);
+	return swap(t);
+}
+
+
+template <class T>
+AVL<T>& AVL<T>::operator=(AVL&& param) {
+	if (this != &param) {
+		clear();
+		swap(param);
+	}
+	return *this;
+}
+
+
+template <class T>
+AVL<T>& AVL<T>::swap(AVL& param) {
+	std::swap(root, param.root);
+	std::swap(size_var, param.size_var);
+	std::swap(limit_var, param.limit_var);
+	return *this;
+}
+
+
 template <class T>
 bool AVL<T>::empty(void) const {
 	return size_var == 0;
@@ -315,6 +696,7 @@ bool AVL<T>::find(const T& d) const {
 template <class T>
 AVL<T>& AVL<T>::insert(const T& d) {
 	tdata = &d;
+	tnode = 0;
 	AVL_insert(root);
 	return *this;
 }
@@ -323,7 +705,152 @@ AVL<T>& AVL<T>::insert(const T& d) {
 template <class T>
 AVL<T>& AVL<T>::extract(const T& d) {
 	tdata = &d;
+	tnode = 0;
 	AVL_delete(root);
+	delete tnode;
+	return *this;
+}
+
+
+/* Unlinks the node of d without freeing it; the handle is empty if d is not here */
+template <class T>
+typename AVL<T>::node_handle AVL<T>::extract_node(const T& d) {
+	tdata = &d;
+	tnode = 0;
+	AVL_delete(root);
+	if (tnode) tnode->left = tnode->right = 0;
+	return node_handle(tnode);
+}
+
+
+/* Takes the node out of h, unless its key is already here; then h keeps it */
+template <class T>
+AVL<T>& AVL<T>::insert(node_handle&& h) {
+	unsigned int n = size_var;
+	if (!h.p) return *this;
+	h.p->left = h.p->right = 0;
+	h.p->balance = 0;
+	tdata = &(h.p->data);
+	tnode = h.p;
+	AVL_insert(root);
+	if (n != size_var) h.p = 0;
+	return *this;
+}
+
+
+/* Moves every node of param whose key is not here, without allocating */
+template <class T>
+AVL<T>& AVL<T>::merge(AVL& param) {
+	node *p = param.root;
+	if (&param == this || !p) return *this;
+	param.root = 0;
+	param.size_var = 0;
+	AVL_merge(p, param);
+	return *this;
+}
+
+
+template <class T>
+AVL<T>& AVL<T>::erase_range(const T& lo, const T& hi) {
+	node *l, *m, *r;
+	int hl, hm, hr, h;
+	if (!root || hi < lo) return *this;
+	l = AVL_split(root, AVL_height(root), lo, false, m, hl, hm);
+	m = AVL_split(m, hm, hi, true, r, hm, hr);
+	if (m) size_var -= AVL_clear(m);
+	root = AVL_join2(l, hl, r, hr, h);
+	return *this;
+}
+
+
+/*
+ * If a comparison throws, the exception is passed on once every thread
+ * has stopped; the tree is then rebalanced and holds some of the batch.
+ */
+template <class T>
+AVL<T>& AVL<T>::apply_batch(const std::vector<batch_op>& ops, unsigned int threads) {
+	std::vector<const batch_op*> a;
+	std::vector<node*> nn;
+	unsigned int i, m = 0, par = 0;
+	long delta = 0;
+	int h;
+	if (ops.empty()) return *this;
+	a.reserve(ops.size());
+	for (i = 0 ; i < ops.size() ; i++)
+		a.push_back(&ops[i]);
+	std::stable_sort(a.begin(), a.end(),
+		[](const batch_op* x, const batch_op* y) { return x->data < y->data; });
+	for (i = 0 ; i < a.size() ; i++) {
+		if (m && !(a[m-1]->data < a[i]->data)) m--;
+		a[m++] = a[i];
+	}
+	a.resize(m);
+	if (limit_var) {
+		unsigned int k = 0;
+		for (i = 0 ; i < m ; i++)
+			k += a[i]->insert;
+		MEM_reserve(memory_usage(), k*MEM_chunk(sizeof(node)), limit_var);
+	}
+	nn.assign(m, 0);
+	try {
+		for (i = 0 ; i < m ; i++)
+			if (a[i]->insert) nn[i] = new node(a[i]->data);
+	} catch (...) {
+		for (i = 0 ; i < m ; i++)
+			delete nn[i];
+		throw;
+	}
+	if (!threads) threads = std::thread::hardware_concurrency();
+	while ((1u << par) < threads) par++;
+	try {
+		root = AVL_batch(root, AVL_height(root), &a[0], &nn[0], m, h, par, delta);
+	} catch (...) {
+		for (i = 0 ; i < m ; i++)
+			delete nn[i];
+		AVL_rebuild();
+		throw;
+	}
+	size_var += delta;
+	return *this;
+}
+
+
+/*
+ * Replaces the keys with those in [first, last), sorted and deduplicated
+ * in parallel. Each thread allocates the nodes of one slice of the keys
+ * in order, so a subtree mostly lies in one run of memory, and the
+ * halves of the tree are then linked on separate threads.
+ */
+template <class T>
+template <class I>
+AVL<T>& AVL<T>::build_from_unsorted(I first, I last, unsigned int threads) {
+	std::vector<T> v(first, last);
+	std::vector<node*> a;
+	node *t;
+	unsigned int n, par = 0;
+	int h;
+	PAR_sort_unique(v, threads);
+	if (v.empty()) return clear();
+	if (limit_var)
+		MEM_reserve(memory_usage(), v.size()*MEM_chunk(sizeof(node))+
+		            MEM_chunk(v.size()*sizeof(node*)), limit_var);
+	n = PAR_threads(threads, v.size());
+	a.assign(v.size(), 0);
+	try {
+		PAR_run(n, [&](unsigned int i) {
+			for (size_t k = v.size()*i/n ; k < v.size()*(i+1)/n ; k++)
+				a[k] = new node(v[k]);
+		});
+	} catch (...) {
+		for (size_t k = 0 ; k < a.size() ; k++)
+			delete a[k];
+		throw;
+	}
+	while ((1u << par) < n) par++;
+	t = AVL_build(&a[0], a.size(), h, par);
+	clear();
+	root = t;
+	size_var = a.size();
 	return *this;
 }
 
@@ -346,11 +873,58 @@ void AVL<T>::display(std::ofstream& out) const {
 }
 
 
+/* Only the nodes: the tree keeps no other buffers between calls */
+template <class T>
+MEM_usage AVL<T>::memory_usage(void) const {
+	MEM_usage u;
+	MEM_nodes(u, size_var, sizeof(node));
+	return u;
+}
+
+
+/*
+ * Makes inserts, apply_batch and build_from_unsorted throw std::bad_alloc,
+ * leaving the tree as it was, if they would take the heap use past bytes;
+ * 0 removes the limit.
+ */
+template <class T>
+AVL<T>& AVL<T>::set_memory_limit(unsigned long long bytes) {
+	limit_var = bytes;
+	return *this;
+}
+
+
+/*
+ * Calls f on every key from several threads, in no order; f must be
+ * thread safe. If it throws, the walk stops and the first exception is
+ * rethrown once every thread has finished.
+ */
+template <class T>
+template <class F>
+void AVL<T>::parallel_for_each(F f, unsigned int threads) const {
+	PAR_for_each(root, size_var, f, threads);
+}
+
+
+/*
+ * combine(init, map(k)) over all keys k; combine must be associative and
+ * commutative. Exceptions from map or combine are passed on as by
+ * parallel_for_each.
+ */
+template <class T>
+template <class R, class M, class C>
+R AVL<T>::parallel_reduce(R init, M map, C combine, unsigned int threads) const {
+	return PAR_reduce(root, size_var, init, map, combine, threads);
+}
+
 
 /* Testing main */
 
+#ifndef NO_TESTING_MAIN
+
 #include <cstdlib>
 #include <ctime>
+#include "perf-counters.h"
 using namespace std;
 
 
@@ -358,6 +932,7 @@ int main(int argc, char **argv)
 {
 	int i, j, n;
 	double t;
+	PERF perf;
 	AVL<int> tree;
 	if (argc > 3) return EXIT_FAILURE;
 	i = time(0);
@@ -371,16 +946,20 @@ int main(int argc, char **argv)
 	cout << "Seed is " << i << endl;
 	cout << "Inserting..." << endl;
 	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
 	for (i = 1 ; i <= n ; i++) {
 		j = rand()%n+1;
 	//	cout << j << ' ';
 		tree.insert(j);
 	}
+	perf.stop();
 	t = ((double)clock())/CLOCKS_PER_SEC-t;
 	cout << t << " secs" << endl;
+	perf.report(n);
 //	cout << "\nPrinting tree..." << endl;
 //	tree.print();
 	cout << "Size of tree is: " << tree.size() << endl;
+	cout << "Memory used is: " << tree.memory_usage() << endl;
 	ofstream out("avl.dot");
 	tree.display(out);
 	out.close();
@@ -388,20 +967,54 @@ int main(int argc, char **argv)
 	cout << "Created tree image at avl.png!" << endl;
 	cout << "Extracting..." << endl;
 	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
 	for (i = 1 ; i <= n ; i++) {
 		j = rand()%n+1;
 	//	cout << j << ' ';
 		tree.extract(j);
 	}
+	perf.stop();
 	t = ((double)clock())/CLOCKS_PER_SEC-t;
 	cout << t << " secs" << endl;
+	perf.report(n);
 //	cout << "\nPrinting tree..." << endl;
 //	tree.print();
+	cout << "Size of tree is: " << tree.size() << endl;
+	cout << "Applying batch..." << endl;
+	vector<AVL<int>::batch_op> ops(n);
+	for (i = 0 ; i < n ; i++) {
+		ops[i].data = rand()%n+1;
+		ops[i].insert = rand()%2;
+	}
+	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
+	tree.apply_batch(ops);
+	perf.stop();
+	t = ((double)clock())/CLOCKS_PER_SEC-t;
+	cout << t << " secs" << endl;
+	perf.report(n);
+	cout << "Size of tree is: " << tree.size() << endl;
+	cout << "Building from unsorted..." << endl;
+	vector<int> keys(n);
+	for (i = 0 ; i < n ; i++)
+		keys[i] = rand()%n+1;
+	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
+	tree.build_from_unsorted(keys.begin(), keys.end());
+	perf.stop();
+	t = ((double)clock())/CLOCKS_PER_SEC-t;
+	cout << t << " secs" << endl;
+	perf.report(n);
 	cout << "Size of tree is: " << tree.size() << endl;
 	cout << "Clearing..." << endl;
 	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
 	tree.clear();
+	perf.stop();
 	t = ((double)clock())/CLOCKS_PER_SEC-t;
 	cout << t << " secs" << endl;
+	perf.report(n);
 	return EXIT_SUCCESS;
 }
+
+#endif
@@ -7,39 +7,111 @@
 
 
 #include <iostream>
+#include <utility>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include "parallel-traversal.h"
+#include "memory-usage.h"
 
 
 template <class T>
 class SP {
 	private:
+		enum { EVICT_SAMPLES = 16 };
 		struct node {
 			T data;
+			unsigned int stamp;
+			unsigned int count;
 			node *left;
 			node *right;
 			node(const T& d, node* l = 0, node* r = 0):
-				data(d), left(l), right(r) {}
+				data(d), stamp(0), count(0), left(l), right(r) {}
 		};
 		node *root;
 		node *tnode;
 		const T* tdata;
 		unsigned int size_var;
+		unsigned int capacity_var;
+		unsigned int clock_var;
+		unsigned int random_var;
+		unsigned long long hits_var;
+		unsigned long long misses_var;
+		unsigned long long evictions_var;
+		bool frozen_var;
+		unsigned long long limit_var;
 		void SP_clear(node*);
 		inline void SP_R_rotate(node*&);
 		inline void SP_L_rotate(node*&);
 		inline void SP_splay(node*&);
 		void SP_copy(node*&, node*);
+		void SP_build(node*&, const T*, unsigned int);
+		void SP_weight_build(node*&, node**, const double*,
+		                     unsigned int, unsigned int);
+		template <class F> void SP_depths(F&) const;
+		inline unsigned int SP_random(void);
+		void SP_evict(void);
+		void SP_trim(void);
+		bool SP_insert(const T&, node*);
+		node* SP_remove(const T&);
+		template <class F> void SP_for_each(node*, F&) const;
 		void SP_print(node*) const;
 	public:
+		class node_handle {
+			friend class SP<T>;
+			private:
+				node *p;
+				explicit node_handle(node* n): p(n) {}
+				node_handle(const node_handle&);
+				node_handle& operator=(const node_handle&);
+			public:
+				node_handle(void): p(0) {}
+				node_handle(node_handle&& h): p(h.p) { h.p = 0; }
+				~node_handle(void) { delete p; }
+				node_handle& operator=(node_handle&& h) {
+					if (this != &h) {
+						delete p;
+						p = h.p;
+						h.p = 0;
+					}
+					return *this;
+				}
+				bool empty(void) const { return !p; }
+				T& value(void) const { return p->data; }
+		};
 		SP(void);
 		SP(const SP&);
+		SP(SP&&);
 		~SP(void);
+		SP<T>& operator=(const SP&);
+		SP<T>& operator=(SP&&);
+		SP<T>& swap(SP&);
 		bool empty(void) const;
 		unsigned int size(void) const;
 		SP<T>& clear(void);
 		bool find(const T&);
 		SP<T>& insert(const T&);
 		SP<T>& extract(const T&);
+		node_handle extract_node(const T&);
+		SP<T>& insert(node_handle&&);
+		SP<T>& merge(SP&);
+		SP<T>& build(const T*, unsigned int);
+		unsigned int depth(const T&) const;
+		template <class F> void for_each(F) const;
+		template <class F> void parallel_for_each(F, unsigned int = 0) const;
+		template <class R, class M, class C> R parallel_reduce(R, M, C, unsigned int = 0) const;
 		void print(void) const;
+		SP<T>& set_capacity(unsigned int);
+		unsigned int capacity(void) const;
+		unsigned long long hits(void) const;
+		unsigned long long misses(void) const;
+		unsigned long long evictions(void) const;
+		SP<T>& build_weight_optimal(void);
+		bool frozen(void) const;
+		double expected_depth(void) const;
+		double entropy(void) const;
+		MEM_usage memory_usage(void) const;
+		SP<T>& set_memory_limit(unsigned long long);
 };
 
 
@@ -101,11 +173,110 @@ inline void SP<T>::SP_splay(node*& p) {
 template <class T>
 void SP<T>::SP_copy(node*& p, node* rp) {
 	p = new node(rp->data);
+	p->stamp = rp->stamp;
+	p->count = rp->count;
 	if (rp->left) SP_copy(p->left, rp->left);
 	if (rp->right) SP_copy(p->right, rp->right);
 }
 
 
+template <class T>
+void SP<T>::SP_build(node*& p, const T* a, unsigned int n) {
+	unsigned int m = n/2;
+	p = new node(a[m]);
+	if (m) SP_build(p->left, a, m);
+	if (n-m-1) SP_build(p->right, a+m+1, n-m-1);
+}
+
+
+/* Links v[l..r) under p, each root splitting the prefix weights w at half */
+template <class T>
+void SP<T>::SP_weight_build(node*& p, node** v, const double* w,
+                            unsigned int l, unsigned int r) {
+	unsigned int k = std::upper_bound(w+l+1, w+r+1, w[l]+(w[r]-w[l])/2)-(w+1);
+	p = v[k];
+	p->left = p->right = 0;
+	if (l < k) SP_weight_build(p->left, v, w, l, k);
+	if (k+1 < r) SP_weight_build(p->right, v, w, k+1, r);
+}
+
+
+/* Calls f(count, depth) for every node, the root at depth 1, without recursing */
+template <class T>
+template <class F>
+void SP<T>::SP_depths(F& f) const {
+	std::vector<std::pair<node*, unsigned int> > s;
+	if (root) s.push_back(std::make_pair(root, 1u));
+	while (!s.empty()) {
+		node *p = s.back().first;
+		unsigned int d = s.back().second;
+		s.pop_back();
+		f(p->count, d);
+		if (p->left) s.push_back(std::make_pair(p->left, d+1));
+		if (p->right) s.push_back(std::make_pair(p->right, d+1));
+	}
+}
+
+
+template <class T>
+inline unsigned int SP<T>::SP_random(void) {
+	random_var ^= random_var << 13;
+	random_var ^= random_var >> 17;
+	random_var ^= random_var << 5;
+	return random_var;
+}
+
+
+/*
+ * Evicts a cold key without splaying. Recently used keys sit near the
+ * root, so EVICT_SAMPLES random walks are taken down from the children
+ * of the root, each ending at a node with a free child, and the one of
+ * them with the oldest access stamp is spliced out. The root is kept
+ * unless it is the only node.
+ */
+template <class T>
+void SP<T>::SP_evict(void) {
+	node **v = 0, **p, *t;
+	unsigned int r, age = 0;
+	if (!root->left && !root->right) v = &root;
+	else for (unsigned int i = 0 ; i < EVICT_SAMPLES ; i++) {
+		r = SP_random();
+		p = (r & 1) && root->left ? &root->left : root->right ? &root->right : &root->left;
+		for (r >>= 1 ; ; r >>= 1) {
+			if (!r) r = SP_random() | 0x80000000u;
+			t = (r & 1) ? (*p)->left : (*p)->right;
+			if (!t) break;
+			p = (r & 1) ? &(*p)->left : &(*p)->right;
+		}
+		if (!v || clock_var-(*p)->stamp > age) {
+			v = p;
+			age = clock_var-(*p)->stamp;
+		}
+	}
+	t = *v;
+	*v = t->left ? t->left : t->right;
+	delete t;
+	size_var--;
+	evictions_var++;
+}
+
+
+template <class T>
+void SP<T>::SP_trim(void) {
+	while (capacity_var && size_var > capacity_var)
+		SP_evict();
+}
+
+
+template <class T>
+template <class F>
+void SP<T>::SP_for_each(node* p, F& f) const {
+	if (p->left) SP_for_each(p->left, f);
+	f(p->data);
+	if (p->right) SP_for_each(p->right, f);
+}
+
+
 template <class T>
 void SP<T>::SP_print(node* p) const {
 	if (p->left) SP_print(p->left);
@@ -116,12 +287,17 @@ void SP<T>::SP_print(node* p) const {
 
 template <class T>
 SP<T>::SP(void):
-	root(0), tnode(0), size_var(0) {}
+	root(0), tnode(0), size_var(0), capacity_var(0), clock_var(0),
+	random_var(2463534242u), hits_var(0), misses_var(0), evictions_var(0),
+	frozen_var(false), limit_var(0) {}
 
 
 template <class T>
 SP<T>::SP(const SP& param):
-	root(0), tnode(0), size_var(param.size_var) {
+	root(0), tnode(0), size_var(param.size_var), capacity_var(param.capacity_var),
+	clock_var(param.clock_var), random_var(param.random_var), hits_var(param.hits_var),
+	misses_var(param.misses_var), evictions_var(param.evictions_var),
+	frozen_var(param.frozen_var), limit_var(param.limit_var) {
 	if (param.root) {
 		try {
 			if (param.tnode)
@@ -136,6 +312,15 @@ SP<T>::SP(const SP& param):
 }
 
 
+template <class T>
+SP<T>::SP(SP&& param):
+	root(0), tnode(0), size_var(0), capacity_var(0), clock_var(0),
+	random_var(2463534242u), hits_var(0), misses_var(0), evictions_var(0),
+	frozen_var(false), limit_var(0) {
+	swap(param);
+}
+
+
 template <class T>
 SP<T>::~SP(void) {
 	if (tnode) delete tnode;
@@ -143,6 +328,40 @@ SP<T>::~SP(void) {
 }
 
 
+template <class T>
+SP<T>& SP<T>::operator=(const SP& param) {
+	SP<T> t(param);
+	return swap(t);
+}
+
+
+template <class T>
+SP<T>& SP<T>::operator=(SP&& param) {
+	if (this != &param) {
+		clear();
+		swap(param);
+	}
+	return *this;
+}
+
+
+template <class T>
+SP<T>& SP<T>::swap(SP& param) {
+	std::swap(root, param.root);
+	std::swap(tnode, param.tnode);
+	std::swap(size_var, param.size_var);
+	std::swap(capacity_var, param.capacity_var);
+	std::swap(clock_var, param.clock_var);
+	std::swap(random_var, param.random_var);
+	std::swap(hits_var, param.hits_var);
+	std::swap(misses_var, param.misses_var);
+	std::swap(evictions_var, param.evictions_var);
+	std::swap(frozen_var, param.frozen_var);
+	std::swap(limit_var, param.limit_var);
+	return *this;
+}
+
+
 template <class T>
 bool SP<T>::empty(void) const {
 	return size_var == 0;
@@ -164,48 +383,80 @@ SP<T>& SP<T>::clear(void) {
 }
 
 
+/* Once frozen, a plain search that writes nothing */
 template <class T>
 bool SP<T>::find(const T& d) {
-	if (!root) return false;
-	tdata = &d;
-	SP_splay(root);
-	return d == root->data;
+	if (frozen_var) {
+		node *p = root;
+		while (p)
+			if (d < p->data) p = p->left;
+			else if (!(d == p->data)) p = p->right;
+			else return true;
+		return false;
+	}
+	if (root) {
+		tdata = &d;
+		SP_splay(root);
+		if (d == root->data) {
+			root->stamp = ++clock_var;
+			root->count++;
+			hits_var++;
+			return true;
+		}
+	}
+	misses_var++;
+	return false;
 }
 
 
+/*
+ * Links n, or a new node of d if n is 0, at the root; false if d is
+ * already here. A full cache evicts only once the node is allocated, so
+ * a throwing insert leaves every key in place.
+ */
 template <class T>
-SP<T>& SP<T>::insert(const T& d) {
-	node *t;
-	if (!root) {
-		if (!tnode) tnode = new node(d);
-		root = new node(d);
-		size_var++;
-		return *this;
+bool SP<T>::SP_insert(const T& d, node* n) {
+	frozen_var = false;
+	if (root) {
+		tdata = &d;
+		SP_splay(root);
+		if (d == root->data) {
+			root->stamp = ++clock_var;
+			return false;
+		}
 	}
-	tdata = &d;
-	SP_splay(root);
-	if (d < root->data) {
-		t = new node(d, root->left, root);
+	if (!n && limit_var)
+		MEM_reserve(memory_usage(), (tnode ? 1 : 2)*MEM_chunk(sizeof(node)), limit_var);
+	if (!tnode) tnode = new node(d);
+	if (!n) n = new node(d);
+	if (root && capacity_var && size_var >= capacity_var) SP_evict();
+	if (!root)
+		n->left = n->right = 0;
+	else if (d < root->data) {
+		n->left = root->left;
+		n->right = root;
 		root->left = 0;
-		root = t;
-		size_var++;
-	} else if (!(d == root->data)) {
-		t = new node(d, root, root->right);
+	} else {
+		n->left = root;
+		n->right = root->right;
 		root->right = 0;
-		root = t;
-		size_var++;
 	}
-	return *this;
+	root = n;
+	root->stamp = ++clock_var;
+	size_var++;
+	return true;
 }
 
 
+/* Unlinks the node of d and returns it, or 0 if d is not here */
 template <class T>
-SP<T>& SP<T>::extract(const T& d) {
-	node *t;
-	if (!root) return *this;
+typename SP<T>::node* SP<T>::SP_remove(const T& d) {
+	node *t, *r;
+	frozen_var = false;
+	if (!root) return 0;
 	tdata = &d;
 	SP_splay(root);
-	if (!(d == root->data)) return *this;
+	if (!(d == root->data)) return 0;
 	if (!root->left)
 		t = root->right;
 	else {
@@ -213,13 +464,111 @@ SP<T>& SP<T>::extract(const T& d) {
 		SP_splay(t);
 		t->right = root->right;
 	}
-	delete root;
+	r = root;
+	r->left = r->right = 0;
 	root = t;
 	size_var--;
+	return r;
+}
+
+
+template <class T>
+SP<T>& SP<T>::insert(const T& d) {
+	SP_insert(d, 0);
+	return *this;
+}
+
+
+template <class T>
+SP<T>& SP<T>::extract(const T& d) {
+	delete SP_remove(d);
+	return *this;
+}
+
+
+/* Unlinks the node of d without freeing it; the handle is empty if d is not here */
+template <class T>
+typename SP<T>::node_handle SP<T>::extract_node(const T& d) {
+	return node_handle(SP_remove(d));
+}
+
+
+/* Takes the node out of h, unless its key is already here; then h keeps it */
+template <class T>
+SP<T>& SP<T>::insert(node_handle&& h) {
+	if (h.p && SP_insert(h.p->data, h.p)) h.p = 0;
+	return *this;
+}
+
+
+/*
+ * Moves every node of param whose key is not here, without allocating
+ * (except for the splay header of an empty tree); the rest stay in
+ * param. The nodes are taken off the root of param, which leaves the
+ * next key in order at its root.
+ */
+template <class T>
+SP<T>& SP<T>::merge(SP& param) {
+	node *p, *t;
+	if (&param == this || !param.root) return *this;
+	p = param.root;
+	param.root = 0;
+	param.size_var = 0;
+	while (p)
+		if (p->left) {
+			t = p->left;
+			p->left = t->right;
+			t->right = p;
+			p = t;
+		} else {
+			t = p;
+			p = p->right;
+			if (!SP_insert(t->data, t))
+				param.SP_insert(t->data, t);
+		}
+	return *this;
+}
+
+
+template <class T>
+SP<T>& SP<T>::build(const T* a, unsigned int n) {
+	if (limit_var) MEM_reserve(MEM_usage(), (n+1ULL)*MEM_chunk(sizeof(node)), limit_var);
+	clear();
+	if (!n) return *this;
+	if (!tnode) tnode = new node(a[0]);
+	try {
+		SP_build(root, a, n);
+	} catch (...) {
+		clear();
+		throw;
+	}
+	size_var = n;
+	SP_trim();
 	return *this;
 }
 
 
+template <class T>
+unsigned int SP<T>::depth(const T& d) const {
+	unsigned int c = 0;
+	node *p = root;
+	while (p) {
+		c++;
+		if (d < p->data) p = p->left;
+		else if (!(d == p->data)) p = p->right;
+		else break;
+	}
+	return c;
+}
+
+
+template <class T>
+template <class F>
+void SP<T>::for_each(F f) const {
+	if (root) SP_for_each(root, f);
+}
+
+
 template <class T>
 void SP<T>::print(void) const {
 	if (root) SP_print(root);
@@ -227,11 +576,184 @@ void SP<T>::print(void) const {
 }
 
 
+/* A capacity of 0 means unbounded; otherwise insert evicts a cold key when full */
+template <class T>
+SP<T>& SP<T>::set_capacity(unsigned int c) {
+	capacity_var = c;
+	SP_trim();
+	return *this;
+}
+
+
+template <class T>
+unsigned int SP<T>::capacity(void) const {
+	return capacity_var;
+}
+
+
+template <class T>
+unsigned long long SP<T>::hits(void) const {
+	return hits_var;
+}
+
+
+template <class T>
+unsigned long long SP<T>::misses(void) const {
+	return misses_var;
+}
+
+
+template <class T>
+unsigned long long SP<T>::evictions(void) const {
+	return evictions_var;
+}
+
+
+
+/*
+ * Rebuilds the tree from the access counts find recorded by Mehlhorn's
+ * rule: the root of every subtree is the key whose weight interval holds
+ * the middle of the subtree weight. Out of n keys one found c times
+ * weighs c*n+1, so the keys never found weigh as much as one find between
+ * them. A key of weight w out of W then lies at depth at most
+ * log2(W/w)+2, and the expected depth is at most about 2 above the
+ * entropy.
+ * The tree stays frozen, find neither splays nor counts, until the next
+ * insert or extract.
+ */
+template <class T>
+SP<T>& SP<T>::build_weight_optimal(void) {
+	std::vector<node*> v;
+	std::vector<double> w;
+	node *p = root, *t;
+	if (!root) return *this;
+	v.reserve(size_var);
+	w.reserve(size_var+1);
+	w.push_back(0);
+	while (p)
+		if (p->left) {
+			t = p->left;
+			p->left = t->right;
+			t->right = p;
+			p = t;
+		} else {
+			v.push_back(p);
+			w.push_back(w.back()+(double)p->count*size_var+1);
+			p = p->right;
+		}
+	SP_weight_build(root, &v[0], &w[0], 0, v.size());
+	frozen_var = true;
+	return *this;
+}
+
+
+template <class T>
+bool SP<T>::frozen(void) const {
+	return frozen_var;
+}
+
+
+template <class T>
+struct SP_depth_sum {
+	unsigned long long n, d;
+	SP_depth_sum(void): n(0), d(0) {}
+	void operator()(unsigned int c, unsigned int h) {
+		n += c;
+		d += (unsigned long long)c*h;
+	}
+};
+
+
+/* Average depth of a find over the recorded accesses, the root at depth 1 */
+template <class T>
+double SP<T>::expected_depth(void) const {
+	SP_depth_sum<T> f;
+	SP_depths(f);
+	return f.n ? (double)f.d/f.n : 0;
+}
+
+
+template <class T>
+struct SP_entropy_sum {
+	std::vector<unsigned int> c;
+	void operator()(unsigned int n, unsigned int) {
+		if (n) c.push_back(n);
+	}
+};
+
+
+/*
+ * Entropy H in bits of the recorded accesses. As every comparison has three
+ * outcomes, no tree keeping keys in its nodes has an expected depth below
+ * H/log2(3); H itself may well be above expected_depth().
+ */
+template <class T>
+double SP<T>::entropy(void) const {
+	SP_entropy_sum<T> f;
+	unsigned long long n = 0;
+	double h = 0;
+	SP_depths(f);
+	for (unsigned int i = 0 ; i < f.c.size() ; i++)
+		n += f.c[i];
+	for (unsigned int i = 0 ; i < f.c.size() ; i++)
+		h -= (double)f.c[i]/n*std::log2((double)f.c[i]/n);
+	return h;
+}
+
+
+/* The spare node splaying works with counts as a buffer */
+template <class T>
+MEM_usage SP<T>::memory_usage(void) const {
+	MEM_usage u;
+	MEM_nodes(u, size_var, sizeof(node));
+	if (tnode) MEM_block(u, sizeof(node));
+	return u;
+}
+
+
+/*
+ * Makes inserts and build throw std::bad_alloc, before any key is added
+ * or evicted, if they would take the heap use past bytes; 0 removes the
+ * limit.
+ */
+template <class T>
+SP<T>& SP<T>::set_memory_limit(unsigned long long bytes) {
+	limit_var = bytes;
+	return *this;
+}
+
+
+/*
+ * Calls f on every key from several threads, in no order; f must be
+ * thread safe. If it throws, the walk stops and the first exception is
+ * rethrown once every thread has finished.
+ */
+template <class T>
+template <class F>
+void SP<T>::parallel_for_each(F f, unsigned int threads) const {
+	PAR_for_each(root, size_var, f, threads);
+}
+
+
+/*
+ * combine(init, map(k)) over all keys k; combine must be associative and
+ * commutative. Exceptions from map or combine are passed on as by
+ * parallel_for_each.
+ */
+template <class T>
+template <class R, class M, class C>
+R SP<T>::parallel_reduce(R init, M map, C combine, unsigned int threads) const {
+	return PAR_reduce(root, size_var, init, map, combine, threads);
+}
+
 
 /* Testing main */
 
+#ifndef NO_TESTING_MAIN
+
 #include <cstdlib>
 #include <ctime>
+#include "perf-counters.h"
 using namespace std;
 
 
@@ -239,6 +761,7 @@ int main(int argc, char **argv)
 {
 	int i, j, n;
 	double t;
+	PERF perf;
 	SP<int> tree;
 	if (argc > 3) return EXIT_FAILURE;
 	i = time(0);
@@ -252,32 +775,82 @@ int main(int argc, char **argv)
 	cout << "Seed is " << i << endl;
 	cout << "Inserting..." << endl;
 	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
 	for (i = 1 ; i <= n ; i++) {
 		j = rand()%n+1;
 	//	cout << j << ' ';
 		tree.insert(j);
 	}
+	perf.stop();
 	t = ((double)clock())/CLOCKS_PER_SEC-t;
 	cout << t << " secs" << endl;
+	perf.report(n);
 //	cout << "\nPrinting tree..." << endl;
 //	tree.print();
 	cout << "Size of tree is: " << tree.size() << endl;
+	cout << "Memory used is: " << tree.memory_usage() << endl;
 	cout << "Extracting..." << endl;
 	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
 	for (i = 1 ; i <= n ; i++) {
 		j = rand()%n+1;
 	//	cout << j << ' ';
 		tree.extract(j);
 	}
+	perf.stop();
 	t = ((double)clock())/CLOCKS_PER_SEC-t;
 	cout << t << " secs" << endl;
+	perf.report(n);
 //	cout << "\nPrinting tree..." << endl;
 //	tree.print();
 	cout << "Size of tree is: " << tree.size() << endl;
+	cout << "Caching skewed lookups with capacity " << n/8+1 << "..." << endl;
+	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
+	tree.set_capacity(n/8+1);
+	for (i = 1 ; i <= 4*n ; i++) {
+		j = rand()%n+1;
+		if (rand()%8) j %= n/16+1;
+		if (!tree.find(j)) tree.insert(j);
+	}
+	perf.stop();
+	t = ((double)clock())/CLOCKS_PER_SEC-t;
+	cout << t << " secs" << endl;
+	perf.report(4*n);
+	cout << "Hit ratio is: " << (double)tree.hits()/(tree.hits()+tree.misses())
+	     << ", evictions: " << tree.evictions() << endl;
+	cout << "Size of tree is: " << tree.size() << endl;
+	cout << "Building weight optimal tree..." << endl;
+	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
+	tree.build_weight_optimal();
+	perf.stop();
+	t = ((double)clock())/CLOCKS_PER_SEC-t;
+	cout << t << " secs" << endl;
+	perf.report(tree.size());
+	cout << "Expected depth is: " << tree.expected_depth()
+	     << ", entropy: " << tree.entropy() << endl;
+	cout << "Frozen skewed lookups..." << endl;
+	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
+	for (i = 1, j = 0 ; i <= 4*n ; i++) {
+		int k = rand()%n+1;
+		if (rand()%8) k %= n/16+1;
+		j += tree.find(k);
+	}
+	perf.stop();
+	t = ((double)clock())/CLOCKS_PER_SEC-t;
+	cout << t << " secs, " << j << " found" << endl;
+	perf.report(4*n);
 	cout << "Clearing..." << endl;
 	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
 	tree.clear();
+	perf.stop();
 	t = ((double)clock())/CLOCKS_PER_SEC-t;
 	cout << t << " secs" << endl;
+	perf.report(n);
 	return EXIT_SUCCESS;
 }
+
+#endif
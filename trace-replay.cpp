@@ -0,0 +1,317 @@
+/*
+ * C++ Workload trace recording and replay
+ * Written by orestisp
+ * std06176@di.uoa.gr
+ */
+
+
+
+#define NO_TESTING_MAIN
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <cstring>
+#include <time.h>
+#include "binary-search-tree.cpp"
+#include "iterative-avl-tree.cpp"
+#include "splay-tree.cpp"
+#include "paged-tree.cpp"
+#include "wavl-tree.cpp"
+#include "tree.h"
+#include "perf-counters.h"
+
+
+/*
+ * Trace file: the 4 byte magic "TRC1" followed by 13 byte records,
+ * all fields little endian:
+ *   op (1 byte), key (4 bytes, signed), timestamp (8 bytes, ns
+ *   since the recorder was created)
+ */
+
+enum trace_op { TRACE_INSERT = 0, TRACE_EXTRACT = 1, TRACE_FIND = 2 };
+
+struct trace_record {
+	unsigned char op;
+	int key;
+	unsigned long long time;
+};
+
+
+static inline unsigned long long trace_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec*1000000000ULL+ts.tv_nsec;
+}
+
+
+static void trace_write(std::ostream& out, const trace_record& r) {
+	char buf[13];
+	unsigned int k = (unsigned int)r.key;
+	buf[0] = r.op;
+	for (int i = 0 ; i < 4 ; i++)
+		buf[1+i] = (char)(k >> (8*i));
+	for (int i = 0 ; i < 8 ; i++)
+		buf[5+i] = (char)(r.time >> (8*i));
+	out.write(buf, sizeof(buf));
+}
+
+
+static bool trace_load(std::istream& in, std::vector<trace_record>& v) {
+	unsigned char buf[13];
+	char magic[4];
+	trace_record r;
+	if (!in.read(magic, 4) || magic[0] != 'T' || magic[1] != 'R' ||
+	    magic[2] != 'C' || magic[3] != '1')
+		return false;
+	while (in.read((char*)buf, sizeof(buf))) {
+		unsigned int k = 0;
+		r.op = buf[0];
+		if (r.op > TRACE_FIND) return false;
+		for (int i = 0 ; i < 4 ; i++)
+			k |= (unsigned int)buf[1+i] << (8*i);
+		r.key = (int)k;
+		r.time = 0;
+		for (int i = 0 ; i < 8 ; i++)
+			r.time |= (unsigned long long)buf[5+i] << (8*i);
+		v.push_back(r);
+	}
+	return in.gcount() == 0;
+}
+
+
+/* Recorder: forwards to any of BST/AVL/SP and logs every call */
+
+template <class S>
+class REC {
+	private:
+		S& tree;
+		std::ostream& out;
+		unsigned long long start;
+		void REC_log(unsigned char, const int&);
+	public:
+		REC(S&, std::ostream&);
+		bool empty(void) const;
+		unsigned int size(void) const;
+		bool find(const int&);
+		REC<S>& insert(const int&);
+		REC<S>& extract(const int&);
+};
+
+
+template <class S>
+void REC<S>::REC_log(unsigned char op, const int& d) {
+	trace_record r;
+	r.op = op;
+	r.key = d;
+	r.time = trace_now()-start;
+	trace_write(out, r);
+}
+
+
+template <class S>
+REC<S>::REC(S& t, std::ostream& o):
+	tree(t), out(o), start(trace_now()) {
+	out.write("TRC1", 4);
+}
+
+
+template <class S>
+bool REC<S>::empty(void) const {
+	return tree.empty();
+}
+
+
+template <class S>
+unsigned int REC<S>::size(void) const {
+	return tree.size();
+}
+
+
+template <class S>
+bool REC<S>::find(const int& d) {
+	REC_log(TRACE_FIND, d);
+	return tree.find(d);
+}
+
+
+template <class S>
+REC<S>& REC<S>::insert(const int& d) {
+	REC_log(TRACE_INSERT, d);
+	tree.insert(d);
+	return *this;
+}
+
+
+template <class S>
+REC<S>& REC<S>::extract(const int& d) {
+	REC_log(TRACE_EXTRACT, d);
+	tree.extract(d);
+	return *this;
+}
+
+
+/* std::set behind the same interface as the trees, as a baseline */
+
+template <class T>
+class STL {
+	private:
+		std::set<T> s;
+	public:
+		unsigned int size(void) const { return s.size(); }
+		bool find(const T& d) const { return s.find(d) != s.end(); }
+		STL<T>& insert(const T& d) { s.insert(d); return *this; }
+		STL<T>& extract(const T& d) { s.erase(d); return *this; }
+};
+
+
+/* Rotations done by the engines that count them, -1 for the rest */
+
+template <class S>
+static long long trace_rotations(const S&) {
+	return -1;
+}
+
+
+static long long trace_rotations(const AVL<int>& tree) {
+	return tree.rotations();
+}
+
+
+static long long trace_rotations(const WAVL<int>& tree) {
+	return tree.rotations();
+}
+
+
+template <class C, class B, class A>
+static long long trace_rotations(const tree<int, C, B, A, TREE_counters>& t) {
+	return t.stats().rotations;
+}
+
+
+/*
+ * Replays the trace closed loop (recorded timestamps only order the
+ * operations), once untimed for throughput and once timing every
+ * operation for the latency percentiles.
+ */
+
+template <class S>
+static unsigned int trace_run(S& tree, const trace_record& r) {
+	switch (r.op) {
+		case TRACE_INSERT: tree.insert(r.key); return 0;
+		case TRACE_EXTRACT: tree.extract(r.key); return 0;
+		default: return tree.find(r.key);
+	}
+}
+
+
+template <class S>
+static void trace_replay(const char* name, const std::vector<trace_record>& v) {
+	std::vector<unsigned long long> lat(v.size());
+	unsigned long long t, hits = 0;
+	long long rot;
+	unsigned int size;
+	size_t i, n = v.size();
+	PERF perf;
+	{
+		S tree;
+		t = trace_now();
+		perf.start();
+		for (i = 0 ; i < n ; i++)
+			hits += trace_run(tree, v[i]);
+		perf.stop();
+		t = trace_now()-t;
+		size = tree.size();
+		rot = trace_rotations(tree);
+	}
+	{
+		S tree;
+		for (i = 0 ; i < n ; i++) {
+			unsigned long long s = trace_now();
+			trace_run(tree, v[i]);
+			lat[i] = trace_now()-s;
+		}
+	}
+	std::sort(lat.begin(), lat.end());
+	std::cout << name << ": " << (t ? n*1e9/t : 0) << " ops/sec, "
+	          << "p50 " << lat[n/2] << " ns, "
+	          << "p99 " << lat[n-1-n/100] << " ns, "
+	          << "p99.9 " << lat[n-1-n/1000] << " ns, "
+	          << "max " << lat[n-1] << " ns, "
+	          << "hits " << hits << ", final size " << size;
+	if (rot >= 0) std::cout << ", rotations " << rot;
+	std::cout << std::endl;
+	perf.report(n);
+}
+
+
+
+/* Testing main */
+
+#ifndef NO_TRACE_MAIN
+
+#include <cstdlib>
+#include <ctime>
+using namespace std;
+
+
+int main(int argc, char **argv)
+{
+	int i, j, n;
+	if (argc >= 3 && argc <= 5 && !strcmp(argv[1], "record")) {
+		i = time(0);
+		n = 20;
+		if (argc >= 4) n = atoi(argv[3]);
+		if (argc == 5) i = atoi(argv[4]);
+		srand((unsigned int)i);
+		ofstream out(argv[2], ios::binary);
+		AVL<int> tree;
+		REC<AVL<int> > rec(tree, out);
+		cout << "Size is " << n << endl;
+		cout << "Seed is " << i << endl;
+		for (i = 1 ; i <= n ; i++) {
+			j = rand()%n+1;
+			rec.insert(j);
+		}
+		for (i = 1 ; i <= n ; i++) {
+			j = rand()%n+1;
+			rec.find(j);
+		}
+		for (i = 1 ; i <= n ; i++) {
+			j = rand()%n+1;
+			rec.extract(j);
+		}
+		out.close();
+		cout << "Recorded " << 3*n << " operations to " << argv[2] << endl;
+		return out ? EXIT_SUCCESS : EXIT_FAILURE;
+	}
+	if (argc == 3 && !strcmp(argv[1], "replay")) {
+		vector<trace_record> v;
+		ifstream in(argv[2], ios::binary);
+		if (!trace_load(in, v)) {
+			cerr << "Bad trace file " << argv[2] << endl;
+			return EXIT_FAILURE;
+		}
+		cout << "Replaying " << v.size() << " operations..." << endl;
+		if (v.empty()) return EXIT_SUCCESS;
+		trace_replay<BST<int> >("BST", v);
+		trace_replay<tree<int, std::less<int>, TREE_none> >("tree<none>", v);
+		trace_replay<AVL<int> >("AVL", v);
+		trace_replay<tree<int> >("tree<avl>", v);
+		trace_replay<tree<int, std::less<int>, TREE_avl, std::allocator<int>, TREE_counters> >
+			("tree<avl, counters>", v);
+		trace_replay<WAVL<int> >("WAVL", v);
+		trace_replay<SP<int> >("SP", v);
+		trace_replay<tree<int, std::less<int>, TREE_splay> >("tree<splay>", v);
+		trace_replay<PT<int> >("PT", v);
+		trace_replay<STL<int> >("std::set", v);
+		return EXIT_SUCCESS;
+	}
+	cerr << "Usage: " << argv[0] << " record <file> [size] [seed]" << endl;
+	cerr << "       " << argv[0] << " replay <file>" << endl;
+	return EXIT_FAILURE;
+}
+
+#endif
@@ -0,0 +1,687 @@
+/*
+ * C++ Policy based binary search tree core
+ * Written by orestisp
+ * std06176@di.uoa.gr
+ */
+
+
+
+#ifndef TREE_H
+#define TREE_H
+
+#include <iostream>
+#include <functional>
+#include <memory>
+#include <utility>
+
+
+/*
+ * tree<T, Compare, Balance, Alloc, Stats> is one binary search tree whose
+ * balancing (TREE_none, TREE_avl or TREE_splay), node allocator and
+ * instrumentation are template parameters, so everything is resolved at
+ * compile time and inlined: no virtual calls and no per node cost beyond
+ * what the policy needs (the AVL balance factor). The core keeps the
+ * parts every tree shares (search, copy, clear, traversal, rotations,
+ * allocation); a balancing policy supplies find, insert and remove.
+ */
+
+
+template <class N>
+struct TREE_links {
+	N *left;
+	N *right;
+	TREE_links(void): left(0), right(0) {}
+};
+
+
+/* Instrumentation that does nothing and compiles away */
+struct TREE_no_stats {
+	void compared(void) {}
+	void rotated(void) {}
+	void allocated(void) {}
+	void freed(void) {}
+};
+
+
+/* Counts key comparisons, rotations (double ones twice) and node allocations */
+struct TREE_counters {
+	unsigned long long comparisons;
+	unsigned long long rotations;
+	unsigned long long allocations;
+	unsigned long long frees;
+	TREE_counters(void): comparisons(0), rotations(0), allocations(0), frees(0) {}
+	void compared(void) { comparisons++; }
+	void rotated(void) { rotations++; }
+	void allocated(void) { allocations++; }
+	void freed(void) { frees++; }
+};
+
+
+struct TREE_none;
+struct TREE_avl;
+struct TREE_splay;
+
+
+template <class T, class Compare = std::less<T>, class Balance = TREE_avl,
+          class Alloc = std::allocator<T>, class Stats = TREE_no_stats>
+class tree {
+	friend Balance;
+	public:
+		typedef T value_type;
+	private:
+		struct node: TREE_links<node>, Balance::header {
+			T data;
+			node(const T& d): data(d) {}
+		};
+		typedef typename std::allocator_traits<Alloc>::template rebind_alloc<node> node_alloc;
+		typedef std::allocator_traits<node_alloc> node_traits;
+		node *root;
+		unsigned int size_var;
+		Compare cmp;
+		node_alloc alloc;
+		Stats stats_var;
+		inline bool TREE_less(const T&, const T&);
+		inline node* TREE_search(const T&);
+		inline void TREE_rotate_left(node*&);
+		inline void TREE_rotate_right(node*&);
+		node* TREE_new(const T&);
+		void TREE_delete(node*);
+		void TREE_clear(node*);
+		void TREE_copy(node*&, node*);
+		template <class F> void TREE_for_each(node*, F&) const;
+		void TREE_print(node*) const;
+	public:
+		tree(void);
+		explicit tree(const Compare&, const Alloc& = Alloc());
+		tree(const tree&);
+		tree(tree&&);
+		~tree(void);
+		tree& operator=(const tree&);
+		tree& operator=(tree&&);
+		tree& swap(tree&);
+		bool empty(void) const;
+		unsigned int size(void) const;
+		tree& clear(void);
+		bool find(const T&);
+		tree& insert(const T&);
+		tree& extract(const T&);
+		const T& min(void) const;
+		const T& max(void) const;
+		unsigned int depth(const T&) const;
+		template <class F> void for_each(F) const;
+		void print(void) const;
+		const Stats& stats(void) const;
+};
+
+
+/* Plain binary search tree */
+
+struct TREE_none {
+	struct header {};
+
+	template <class C>
+	static bool find(C& t, const typename C::value_type& d) {
+		return t.TREE_search(d) != 0;
+	}
+
+	template <class C>
+	static bool insert(C& t, const typename C::value_type& d) {
+		typename C::node **p = &t.root;
+		while (*p)
+			if (t.TREE_less(d, (*p)->data)) p = &((*p)->left);
+			else if (t.TREE_less((*p)->data, d)) p = &((*p)->right);
+			else return false;
+		*p = t.TREE_new(d);
+		return true;
+	}
+
+	/* A node with two children is replaced by its successor */
+	template <class C>
+	static typename C::node* remove(C& t, const typename C::value_type& d) {
+		typename C::node **p = &t.root, **q, *x, *s;
+		while (*p)
+			if (t.TREE_less(d, (*p)->data)) p = &((*p)->left);
+			else if (t.TREE_less((*p)->data, d)) p = &((*p)->right);
+			else break;
+		if (!(x = *p)) return 0;
+		if (!x->left) *p = x->right;
+		else if (!x->right) *p = x->left;
+		else {
+			for (q = &(x->right) ; (*q)->left ; q = &((*q)->left));
+			s = *q;
+			*q = s->right;
+			s->left = x->left;
+			s->right = x->right;
+			*p = s;
+		}
+		return x;
+	}
+};
+
+
+/*
+ * AVL tree, iterative as in iterative-avl-tree: the path is kept in fixed
+ * arrays on the stack, as an AVL tree of 2^32 nodes is under 48 high.
+ */
+
+struct TREE_avl {
+	enum { STACK = sizeof(unsigned int)*12 };
+
+	struct header {
+		signed char balance;
+		header(void): balance(0) {}
+	};
+
+	template <class C>
+	static void LL_rotate(C& t, typename C::node*& p) {
+		t.TREE_rotate_right(p);
+		p->right->balance = -(++p->balance);
+	}
+
+	template <class C>
+	static void RR_rotate(C& t, typename C::node*& p) {
+		t.TREE_rotate_left(p);
+		p->left->balance = -(--p->balance);
+	}
+
+	template <class C>
+	static void LR_rotate(C& t, typename C::node*& p) {
+		typename C::node *x = p, *l = x->left;
+		p = l->right;
+		l->right = p->left;
+		x->left = p->right;
+		p->right = x;
+		p->left = l;
+		if (p->balance != 1) {
+			l->balance = 0;
+			x->balance = -p->balance;
+		} else {
+			l->balance = -1;
+			x->balance = 0;
+		}
+		p->balance = 0;
+		t.stats_var.rotated();
+		t.stats_var.rotated();
+	}
+
+	template <class C>
+	static void RL_rotate(C& t, typename C::node*& p) {
+		typename C::node *x = p, *l = x->right;
+		p = l->left;
+		l->left = p->right;
+		x->right = p->left;
+		p->left = x;
+		p->right = l;
+		if (p->balance != -1) {
+			l->balance = 0;
+			x->balance = -p->balance;
+		} else {
+			l->balance = 1;
+			x->balance = 0;
+		}
+		p->balance = 0;
+		t.stats_var.rotated();
+		t.stats_var.rotated();
+	}
+
+	template <class C>
+	static bool find(C& t, const typename C::value_type& d) {
+		return t.TREE_search(d) != 0;
+	}
+
+	template <class C>
+	static bool insert(C& t, const typename C::value_type& d) {
+		typedef typename C::node node;
+		node **pstack[STACK], ***s = pstack, **p = &t.root;
+		bool dstack[STACK], *b = dstack;
+		while (*p) {
+			*(++s) = p;
+			if ((*(++b) = t.TREE_less(d, (*p)->data)))
+				p = &((*p)->left);
+			else if (t.TREE_less((*p)->data, d))
+				p = &((*p)->right);
+			else return false;
+		}
+		*p = t.TREE_new(d);
+		for (; s != pstack ; s--, b--) {
+			p = *s;
+			if (*b) {
+				if ((*p)->balance == -1) {
+					if ((*p)->left->balance != 1) LL_rotate(t, *p);
+					else LR_rotate(t, *p);
+					break;
+				}
+				if (!--(*p)->balance) break;
+			} else {
+				if ((*p)->balance == 1) {
+					if ((*p)->right->balance != -1) RR_rotate(t, *p);
+					else RL_rotate(t, *p);
+					break;
+				}
+				if (!++(*p)->balance) break;
+			}
+		}
+		return true;
+	}
+
+	/* Rebalances after the subtree on side *b of every node in s shrank */
+	template <class C>
+	static void unwind(C& t, typename C::node*** pstack, typename C::node*** s, bool* b) {
+		typename C::node **p;
+		for (; s != pstack ; s--, b--) {
+			p = *s;
+			if (*b) {
+				if ((*p)->balance == 1) {
+					if ((*p)->right->balance != -1) {
+						RR_rotate(t, *p);
+						if ((*p)->balance) return;
+					} else RL_rotate(t, *p);
+				} else if (++(*p)->balance) return;
+			} else {
+				if ((*p)->balance == -1) {
+					if ((*p)->left->balance != 1) {
+						LL_rotate(t, *p);
+						if ((*p)->balance) return;
+					} else LR_rotate(t, *p);
+				} else if (--(*p)->balance) return;
+			}
+		}
+	}
+
+	template <class C>
+	static typename C::node* remove(C& t, const typename C::value_type& d) {
+		typedef typename C::node node;
+		node **pstack[STACK], ***s = pstack, **p = &t.root, *x, *y;
+		bool dstack[STACK], *b = dstack;
+		while (*p) {
+			*(++s) = p;
+			if ((*(++b) = t.TREE_less(d, (*p)->data)))
+				p = &((*p)->left);
+			else if (t.TREE_less((*p)->data, d))
+				p = &((*p)->right);
+			else break;
+		}
+		if (!(x = *p)) return 0;
+		if (!x->left || !x->right) {
+			*p = x->left ? x->left : x->right;
+			s--;
+			b--;
+		} else {
+			node **r = p, ***w = s+1;
+			for (p = &(x->right) ; (*p)->left ; p = &((*p)->left)) {
+				*(++s) = p;
+				*(++b) = true;
+			}
+			y = *p;
+			*p = y->right;
+			y->balance = x->balance;
+			y->left = x->left;
+			y->right = x->right;
+			*r = y;
+			*w = &(y->right);
+		}
+		unwind(t, pstack, s, b);
+		return x;
+	}
+};
+
+
+/* Top down splay tree: every find, insert and remove splays the key to the root */
+
+struct TREE_splay {
+	struct header {};
+
+	template <class C>
+	static void splay(C& t, typename C::node*& p, const typename C::value_type& d) {
+		typedef typename C::node node;
+		TREE_links<node> h, *l = &h, *r = &h;
+		for (;;)
+			if (t.TREE_less(d, p->data)) {
+				if (p->left && t.TREE_less(d, p->left->data))
+					t.TREE_rotate_right(p);
+				if (!p->left) break;
+				r->left = p;
+				r = p;
+				p = p->left;
+			} else if (t.TREE_less(p->data, d)) {
+				if (p->right && t.TREE_less(p->right->data, d))
+					t.TREE_rotate_left(p);
+				if (!p->right) break;
+				l->right = p;
+				l = p;
+				p = p->right;
+			} else break;
+		l->right = p->left;
+		r->left = p->right;
+		p->left = h.right;
+		p->right = h.left;
+	}
+
+	/* After a splay the root holds d, or a neighbour of it */
+	template <class C>
+	static bool at_root(C& t, const typename C::value_type& d) {
+		return !t.TREE_less(d, t.root->data) && !t.TREE_less(t.root->data, d);
+	}
+
+	template <class C>
+	static bool find(C& t, const typename C::value_type& d) {
+		if (!t.root) return false;
+		splay(t, t.root, d);
+		return at_root(t, d);
+	}
+
+	template <class C>
+	static bool insert(C& t, const typename C::value_type& d) {
+		typename C::node *n;
+		if (t.root) {
+			splay(t, t.root, d);
+			if (at_root(t, d)) return false;
+		}
+		n = t.TREE_new(d);
+		if (t.root) {
+			if (t.TREE_less(d, t.root->data)) {
+				n->left = t.root->left;
+				n->right = t.root;
+				t.root->left = 0;
+			} else {
+				n->left = t.root;
+				n->right = t.root->right;
+				t.root->right = 0;
+			}
+		}
+		t.root = n;
+		return true;
+	}
+
+	template <class C>
+	static typename C::node* remove(C& t, const typename C::value_type& d) {
+		typename C::node *x, *l;
+		if (!t.root) return 0;
+		splay(t, t.root, d);
+		if (!at_root(t, d)) return 0;
+		x = t.root;
+		if (!(l = x->left)) t.root = x->right;
+		else {
+			splay(t, l, d);
+			l->right = x->right;
+			t.root = l;
+		}
+		return x;
+	}
+};
+
+
+template <class T, class Compare, class Balance, class Alloc, class Stats>
+inline bool tree<T, Compare, Balance, Alloc, Stats>::TREE_less(const T& a, const T& b) {
+	stats_var.compared();
+	return cmp(a, b);
+}
+
+
+template <class T, class Compare, class Balance, class Alloc, class Stats>
+inline typename tree<T, Compare, Balance, Alloc, Stats>::node*
+tree<T, Compare, Balance, Alloc, Stats>::TREE_search(const T& d) {
+	node *p = root;
+	while (p)
+		if (TREE_less(d, p->data)) p = p->left;
+		else if (TREE_less(p->data, d)) p = p->right;
+		else break;
+	return p;
+}
+
+
+template <class T, class Compare, class Balance, class Alloc, class Stats>
+inline void tree<T, Compare, Balance, Alloc, Stats>::TREE_rotate_left(node*& p) {
+	node *t = p;
+	p = t->right;
+	t->right = p->left;
+	p->left = t;
+	stats_var.rotated();
+}
+
+
+template <class T, class Compare, class Balance, class Alloc, class Stats>
+inline void tree<T, Compare, Balance, Alloc, Stats>::TREE_rotate_right(node*& p) {
+	node *t = p;
+	p = t->left;
+	t->left = p->right;
+	p->right = t;
+	stats_var.rotated();
+}
+
+
+template <class T, class Compare, class Balance, class Alloc, class Stats>
+typename tree<T, Compare, Balance, Alloc, Stats>::node*
+tree<T, Compare, Balance, Alloc, Stats>::TREE_new(const T& d) {
+	node *p = node_traits::allocate(alloc, 1);
+	try {
+		node_traits::construct(alloc, p, d);
+	} catch (...) {
+		node_traits::deallocate(alloc, p, 1);
+		throw;
+	}
+	stats_var.allocated();
+	size_var++;
+	return p;
+}
+
+
+template <class T, class Compare, class Balance, class Alloc, class Stats>
+void tree<T, Compare, Balance, Alloc, Stats>::TREE_delete(node* p) {
+	node_traits::destroy(alloc, p);
+	node_traits::deallocate(alloc, p, 1);
+	stats_var.freed();
+	size_var--;
+}
+
+
+/* Unrolls left children by rotations as it goes, so it needs no stack */
+template <class T, class Compare, class Balance, class Alloc, class Stats>
+void tree<T, Compare, Balance, Alloc, Stats>::TREE_clear(node* p) {
+	node *t;
+	while (p)
+		if (p->left) {
+			t = p->left;
+			p->left = t->right;
+			t->right = p;
+			p = t;
+		} else {
+			t = p;
+			p = p->right;
+			TREE_delete(t);
+		}
+}
+
+
+template <class T, class Compare, class Balance, class Alloc, class Stats>
+void tree<T, Compare, Balance, Alloc, Stats>::TREE_copy(node*& p, node* rp) {
+	p = TREE_new(rp->data);
+	static_cast<typename Balance::header&>(*p) = *rp;
+	if (rp->left) TREE_copy(p->left, rp->left);
+	if (rp->right) TREE_copy(p->right, rp->right);
+}
+
+
+template <class T, class Compare, class Balance, class Alloc, class Stats>
+template <class F>
+void tree<T, Compare, Balance, Alloc, Stats>::TREE_for_each(node* p, F& f) const {
+	if (p->left) TREE_for_each(p->left, f);
+	f(p->data);
+	if (p->right) TREE_for_each(p->right, f);
+}
+
+
+template <class T, class Compare, class Balance, class Alloc, class Stats>
+void tree<T, Compare, Balance, Alloc, Stats>::TREE_print(node* p) const {
+	if (p->left) TREE_print(p->left);
+	std::cout << p->data << ' ';
+	if (p->right) TREE_print(p->right);
+}
+
+
+template <class T, class Compare, class Balance, class Alloc, class Stats>
+tree<T, Compare, Balance, Alloc, Stats>::tree(void):
+	root(0), size_var(0) {}
+
+
+template <class T, class Compare, class Balance, class Alloc, class Stats>
+tree<T, Compare, Balance, Alloc, Stats>::tree(const Compare& c, const Alloc& a):
+	root(0), size_var(0), cmp(c), alloc(a) {}
+
+
+template <class T, class Compare, class Balance, class Alloc, class Stats>
+tree<T, Compare, Balance, Alloc, Stats>::tree(const tree& param):
+	root(0), size_var(0), cmp(param.cmp),
+	alloc(node_traits::select_on_container_copy_construction(param.alloc)) {
+	if (param.root) {
+		try {
+			TREE_copy(root, param.root);
+		} catch (...) {
+			clear();
+			throw;
+		}
+	}
+}
+
+
+template <class T, class Compare, class Balance, class Alloc, class Stats>
+tree<T, Compare, Balance, Alloc, Stats>::tree(tree&& param):
+	root(0), size_var(0), cmp(param.cmp), alloc(param.alloc) {
+	swap(param);
+}
+
+
+template <class T, class Compare, class Balance, class Alloc, class Stats>
+tree<T, Compare, Balance, Alloc, Stats>::~tree(void) {
+	clear();
+}
+
+
+template <class T, class Compare, class Balance, class Alloc, class Stats>
+tree<T, Compare, Balance, Alloc, Stats>&
+tree<T, Compare, Balance, Alloc, Stats>::operator=(const tree& param) {
+	tree t(param);
+	return swap(t);
+}
+
+
+template <class T, class Compare, class Balance, class Alloc, class Stats>
+tree<T, Compare, Balance, Alloc, Stats>&
+tree<T, Compare, Balance, Alloc, Stats>::operator=(tree&& param) {
+	if (this != &param) {
+		clear();
+		swap(param);
+	}
+	return *this;
+}
+
+
+/* Allocators are swapped along, so they need not compare equal */
+template <class T, class Compare, class Balance, class Alloc, class Stats>
+tree<T, Compare, Balance, Alloc, Stats>&
+tree<T, Compare, Balance, Alloc, Stats>::swap(tree& param) {
+	std::swap(root, param.root);
+	std::swap(size_var, param.size_var);
+	std::swap(cmp, param.cmp);
+	std::swap(alloc, param.alloc);
+	std::swap(stats_var, param.stats_var);
+	return *this;
+}
+
+
+template <class T, class Compare, class Balance, class Alloc, class Stats>
+bool tree<T, Compare, Balance, Alloc, Stats>::empty(void) const {
+	return size_var == 0;
+}
+
+
+template <class T, class Compare, class Balance, class Alloc, class Stats>
+unsigned int tree<T, Compare, Balance, Alloc, Stats>::size(void) const {
+	return size_var;
+}
+
+
+template <class T, class Compare, class Balance, class Alloc, class Stats>
+tree<T, Compare, Balance, Alloc, Stats>&
+tree<T, Compare, Balance, Alloc, Stats>::clear(void) {
+	TREE_clear(root);
+	root = 0;
+	return *this;
+}
+
+
+/* Not const, as the splay policy moves the key to the root */
+template <class T, class Compare, class Balance, class Alloc, class Stats>
+bool tree<T, Compare, Balance, Alloc, Stats>::find(const T& d) {
+	return Balance::find(*this, d);
+}
+
+
+template <class T, class Compare, class Balance, class Alloc, class Stats>
+tree<T, Compare, Balance, Alloc, Stats>&
+tree<T, Compare, Balance, Alloc, Stats>::insert(const T& d) {
+	Balance::insert(*this, d);
+	return *this;
+}
+
+
+template <class T, class Compare, class Balance, class Alloc, class Stats>
+tree<T, Compare, Balance, Alloc, Stats>&
+tree<T, Compare, Balance, Alloc, Stats>::extract(const T& d) {
+	node *t = Balance::remove(*this, d);
+	if (t) TREE_delete(t);
+	return *this;
+}
+
+
+template <class T, class Compare, class Balance, class Alloc, class Stats>
+const T& tree<T, Compare, Balance, Alloc, Stats>::min(void) const {
+	node *p = root;
+	while (p->left) p = p->left;
+	return p->data;
+}
+
+
+template <class T, class Compare, class Balance, class Alloc, class Stats>
+const T& tree<T, Compare, Balance, Alloc, Stats>::max(void) const {
+	node *p = root;
+	while (p->right) p = p->right;
+	return p->data;
+}
+
+
+/* Nodes visited by a search for d, without restructuring or counting */
+template <class T, class Compare, class Balance, class Alloc, class Stats>
+unsigned int tree<T, Compare, Balance, Alloc, Stats>::depth(const T& d) const {
+	unsigned int c = 0;
+	node *p = root;
+	while (p) {
+		c++;
+		if (cmp(d, p->data)) p = p->left;
+		else if (cmp(p->data, d)) p = p->right;
+		else break;
+	}
+	return c;
+}
+
+
+template <class T, class Compare, class Balance, class Alloc, class Stats>
+template <class F>
+void tree<T, Compare, Balance, Alloc, Stats>::for_each(F f) const {
+	if (root) TREE_for_each(root, f);
+}
+
+
+template <class T, class Compare, class Balance, class Alloc, class Stats>
+void tree<T, Compare, Balance, Alloc, Stats>::print(void) const {
+	if (root) TREE_print(root);
+	std::cout << std::endl;
+}
+
+
+template <class T, class Compare, class Balance, class Alloc, class Stats>
+const Stats& tree<T, Compare, Balance, Alloc, Stats>::stats(void) const {
+	return stats_var;
+}
+
+#endif
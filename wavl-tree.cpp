@@ -0,0 +1,527 @@
+/*
+ * C++ Weak AVL Tree implementation
+ * Written by orestisp
+ * std06176@di.uoa.gr
+ */
+
+
+
+#include <iostream>
+#include <utility>
+#include "memory-usage.h"
+
+
+/*
+ * Rank balanced (weak AVL) tree. Every node has a rank, a missing child
+ * counts as rank -1, and a child is 1 or 2 ranks below its parent; a leaf
+ * has rank 0. Insertion rebalances exactly like an AVL tree, but deletion
+ * only demotes on the way up and stops after at most one single or
+ * double rotation, so any update does at most two rotations. Without
+ * deletions the tree is an AVL tree; with them it is never taller than
+ * 2 log n.
+ */
+
+template <class T>
+class WAVL {
+	private:
+		enum { STACK = sizeof(unsigned int)*16 };
+		struct node {
+			T data;
+			int rank;
+			node *left;
+			node *right;
+			node(const T& d, int r = 0):
+				data(d), rank(r), left(0), right(0) {}
+		};
+		node *root;
+		unsigned int size_var;
+		unsigned long long rotations_var;
+		unsigned long long limit_var;
+		static inline int WAVL_rank(node*);
+		void WAVL_clear(node*);
+		void WAVL_copy(node*&, node*);
+		template <class F> void WAVL_for_each(node*, F&) const;
+		void WAVL_print(node*) const;
+	public:
+		WAVL(void);
+		WAVL(const WAVL&);
+		WAVL(WAVL&&);
+		~WAVL(void);
+		WAVL<T>& operator=(const WAVL&);
+		WAVL<T>& operator=(WAVL&&);
+		WAVL<T>& swap(WAVL&);
+		bool empty(void) const;
+		unsigned int size(void) const;
+		WAVL<T>& clear(void);
+		bool find(const T&) const;
+		WAVL<T>& insert(const T&);
+		WAVL<T>& extract(const T&);
+		unsigned int depth(const T&) const;
+		template <class F> void for_each(F) const;
+		void print(void) const;
+		unsigned long long rotations(void) const;
+		MEM_usage memory_usage(void) const;
+		WAVL<T>& set_memory_limit(unsigned long long);
+};
+
+
+template <class T>
+inline int WAVL<T>::WAVL_rank(node* p) {
+	return p ? p->rank : -1;
+}
+
+
+template <class T>
+void WAVL<T>::WAVL_clear(node* p) {
+	if (p->left) WAVL_clear(p->left);
+	if (p->right) WAVL_clear(p->right);
+	delete p;
+}
+
+
+template <class T>
+void WAVL<T>::WAVL_copy(node*& p, node* rp) {
+	p = new node(rp->data, rp->rank);
+	if (rp->left) WAVL_copy(p->left, rp->left);
+	if (rp->right) WAVL_copy(p->right, rp->right);
+}
+
+
+template <class T>
+template <class F>
+void WAVL<T>::WAVL_for_each(node* p, F& f) const {
+	if (p->left) WAVL_for_each(p->left, f);
+	f(p->data);
+	if (p->right) WAVL_for_each(p->right, f);
+}
+
+
+template <class T>
+void WAVL<T>::WAVL_print(node* p) const {
+	if (p->left) WAVL_print(p->left);
+	std::cout << p->data << ' ';
+	if (p->right) WAVL_print(p->right);
+}
+
+
+template <class T>
+WAVL<T>::WAVL(void):
+	root(0), size_var(0), rotations_var(0), limit_var(0) {}
+
+
+template <class T>
+WAVL<T>::WAVL(const WAVL& param):
+	root(0), size_var(param.size_var), rotations_var(0), limit_var(param.limit_var) {
+	if (param.root) {
+		try {
+			WAVL_copy(root, param.root);
+		} catch (...) {
+			clear();
+			throw;
+		}
+	}
+}
+
+
+template <class T>
+WAVL<T>::WAVL(WAVL&& param):
+	root(param.root), size_var(param.size_var), rotations_var(param.rotations_var),
+	limit_var(param.limit_var) {
+	param.root = 0;
+	param.size_var = 0;
+	param.rotations_var = 0;
+}
+
+
+template <class T>
+WAVL<T>::~WAVL(void) {
+	clear();
+}
+
+
+template <class T>
+WAVL<T>& WAVL<T>::operator=(const WAVL& param) {
+	WAVL<T> t(param);
+	return swap(t);
+}
+
+
+template <class T>
+WAVL<T>& WAVL<T>::operator=(WAVL&& param) {
+	if (this != &param) {
+		clear();
+		swap(param);
+	}
+	return *this;
+}
+
+
+template <class T>
+WAVL<T>& WAVL<T>::swap(WAVL& param) {
+	std::swap(root, param.root);
+	std::swap(size_var, param.size_var);
+	std::swap(rotations_var, param.rotations_var);
+	std::swap(limit_var, param.limit_var);
+	return *this;
+}
+
+
+template <class T>
+bool WAVL<T>::empty(void) const {
+	return size_var == 0;
+}
+
+
+template <class T>
+unsigned int WAVL<T>::size(void) const {
+	return size_var;
+}
+
+
+template <class T>
+WAVL<T>& WAVL<T>::clear(void) {
+	if (root) WAVL_clear(root);
+	root = 0;
+	size_var = 0;
+	return *this;
+}
+
+
+template <class T>
+bool WAVL<T>::find(const T& d) const {
+	node *p = root;
+	while (p)
+		if (d < p->data) p = p->left;
+		else if (!(d == p->data)) p = p->right;
+		else return true;
+	return false;
+}
+
+
+/*
+ * While the node x just inserted or promoted has the rank of its parent z,
+ * z is promoted if the sibling of x is a 1-child. Otherwise one single or
+ * double rotation restores the ranks and ends the update.
+ */
+template <class T>
+WAVL<T>& WAVL<T>::insert(const T& d) {
+	node **s[STACK], ***t = s, **p = &root, *x, *y, *z;
+	while (*p) {
+		*(t++) = p;
+		if (d < (*p)->data) p = &((*p)->left);
+		else if (!(d == (*p)->data)) p = &((*p)->right);
+		else return *this;
+	}
+	if (limit_var) MEM_reserve(memory_usage(), MEM_chunk(sizeof(node)), limit_var);
+	x = *p = new node(d);
+	size_var++;
+	while (t != s) {
+		p = *(--t);
+		z = *p;
+		if (z->rank != x->rank) break;
+		if (x == z->left) {
+			if (z->rank-WAVL_rank(z->right) == 1) {
+				z->rank++;
+				x = z;
+				continue;
+			}
+			y = x->right;
+			if (x->rank-WAVL_rank(y) == 2) {
+				*p = x;
+				z->left = y;
+				x->right = z;
+				z->rank--;
+				rotations_var++;
+			} else {
+				*p = y;
+				x->right = y->left;
+				z->left = y->right;
+				y->left = x;
+				y->right = z;
+				y->rank++;
+				x->rank--;
+				z->rank--;
+				rotations_var += 2;
+			}
+		} else {
+			if (z->rank-WAVL_rank(z->left) == 1) {
+				z->rank++;
+				x = z;
+				continue;
+			}
+			y = x->left;
+			if (x->rank-WAVL_rank(y) == 2) {
+				*p = x;
+				z->right = y;
+				x->left = z;
+				z->rank--;
+				rotations_var++;
+			} else {
+				*p = y;
+				x->left = y->right;
+				z->right = y->left;
+				y->right = x;
+				y->left = z;
+				y->rank++;
+				x->rank--;
+				z->rank--;
+				rotations_var += 2;
+			}
+		}
+		break;
+	}
+	return *this;
+}
+
+
+/*
+ * After the unlink, a parent z left as a leaf of rank 1 is demoted, and
+ * so is z while the child x below it is 3 ranks down and its sibling y
+ * is a 2-child, or a 1-child with two 2-children (y is demoted too).
+ * Otherwise one single or double rotation ends the update.
+ */
+template <class T>
+WAVL<T>& WAVL<T>::extract(const T& d) {
+	node **s[STACK], ***t = s, **p = &root, *x, *y, *z, *v, *w;
+	while (*p)
+		if (d < (*p)->data) {
+			*(t++) = p;
+			p = &((*p)->left);
+		} else if (!(d == (*p)->data)) {
+			*(t++) = p;
+			p = &((*p)->right);
+		} else break;
+	if (!*p) return *this;
+	y = *p;
+	if (!y->left || !y->right)
+		x = *p = y->left ? y->left : y->right;
+	else {
+		node ***u = t, **q = &(y->right);
+		*(t++) = p;
+		while ((*q)->left) {
+			*(t++) = q;
+			q = &((*q)->left);
+		}
+		z = *q;
+		x = *q = z->right;
+		z->left = y->left;
+		z->right = y->right;
+		z->rank = y->rank;
+		*p = z;
+		if (u+1 != t) *(u+1) = &(z->right);
+	}
+	delete y;
+	size_var--;
+	while (t != s) {
+		p = *(t-1);
+		z = *p;
+		if (!z->left && !z->right && z->rank == 1) {
+			z->rank = 0;
+			x = z;
+			t--;
+			continue;
+		}
+		if (z->rank-WAVL_rank(x) != 3) break;
+		if (x == z->left) {
+			y = z->right;
+			if (z->rank-y->rank == 2) {
+				z->rank--;
+				x = z;
+				t--;
+				continue;
+			}
+			if (y->rank-WAVL_rank(y->left) == 2 && y->rank-WAVL_rank(y->right) == 2) {
+				z->rank--;
+				y->rank--;
+				x = z;
+				t--;
+				continue;
+			}
+			v = y->left;
+			w = y->right;
+			if (y->rank-WAVL_rank(w) == 1) {
+				*p = y;
+				z->right = v;
+				y->left = z;
+				y->rank++;
+				z->rank--;
+				if (!z->left && !v) z->rank--;
+				rotations_var++;
+			} else {
+				*p = v;
+				z->right = v->left;
+				y->left = v->right;
+				v->left = z;
+				v->right = y;
+				v->rank += 2;
+				y->rank--;
+				z->rank -= 2;
+				rotations_var += 2;
+			}
+		} else {
+			y = z->left;
+			if (z->rank-y->rank == 2) {
+				z->rank--;
+				x = z;
+				t--;
+				continue;
+			}
+			if (y->rank-WAVL_rank(y->left) == 2 && y->rank-WAVL_rank(y->right) == 2) {
+				z->rank--;
+				y->rank--;
+				x = z;
+				t--;
+				continue;
+			}
+			v = y->right;
+			w = y->left;
+			if (y->rank-WAVL_rank(w) == 1) {
+				*p = y;
+				z->left = v;
+				y->right = z;
+				y->rank++;
+				z->rank--;
+				if (!z->right && !v) z->rank--;
+				rotations_var++;
+			} else {
+				*p = v;
+				z->left = v->right;
+				y->right = v->left;
+				v->right = z;
+				v->left = y;
+				v->rank += 2;
+				y->rank--;
+				z->rank -= 2;
+				rotations_var += 2;
+			}
+		}
+		break;
+	}
+	return *this;
+}
+
+
+template <class T>
+unsigned int WAVL<T>::depth(const T& d) const {
+	unsigned int c = 0;
+	node *p = root;
+	while (p) {
+		c++;
+		if (d < p->data) p = p->left;
+		else if (!(d == p->data)) p = p->right;
+		else break;
+	}
+	return c;
+}
+
+
+template <class T>
+template <class F>
+void WAVL<T>::for_each(F f) const {
+	if (root) WAVL_for_each(root, f);
+}
+
+
+template <class T>
+void WAVL<T>::print(void) const {
+	if (root) WAVL_print(root);
+	std::cout << std::endl;
+}
+
+
+/* Single rotations count once and double rotations twice */
+template <class T>
+unsigned long long WAVL<T>::rotations(void) const {
+	return rotations_var;
+}
+
+
+template <class T>
+MEM_usage WAVL<T>::memory_usage(void) const {
+	MEM_usage u;
+	MEM_nodes(u, size_var, sizeof(node));
+	return u;
+}
+
+
+/* Makes inserts that would take the heap use past bytes throw std::bad_alloc; 0 removes the limit */
+template <class T>
+WAVL<T>& WAVL<T>::set_memory_limit(unsigned long long bytes) {
+	limit_var = bytes;
+	return *this;
+}
+
+
+
+/* Testing main */
+
+#ifndef NO_TESTING_MAIN
+
+#include <cstdlib>
+#include <ctime>
+#include "perf-counters.h"
+using namespace std;
+
+
+int main(int argc, char **argv)
+{
+	int i, j, n;
+	double t;
+	unsigned long long r;
+	PERF perf;
+	WAVL<int> tree;
+	if (argc > 3) return EXIT_FAILURE;
+	i = time(0);
+	if (argc == 1) n = 20;
+	else {
+		n = atoi(argv[1]);
+		if (argc == 3) i = atoi(argv[2]);
+	}
+	srand((unsigned int)i);
+	cout << "Size is " << n << endl;
+	cout << "Seed is " << i << endl;
+	cout << "Inserting..." << endl;
+	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
+	for (i = 1 ; i <= n ; i++) {
+		j = rand()%n+1;
+	//	cout << j << ' ';
+		tree.insert(j);
+	}
+	perf.stop();
+	t = ((double)clock())/CLOCKS_PER_SEC-t;
+	cout << t << " secs" << endl;
+	perf.report(n);
+//	cout << "\nPrinting tree..." << endl;
+//	tree.print();
+	cout << "Size of tree is: " << tree.size() << endl;
+	cout << "Memory used is: " << tree.memory_usage() << endl;
+	cout << "Rotations: " << (r = tree.rotations()) << endl;
+	cout << "Extracting..." << endl;
+	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
+	for (i = 1 ; i <= n ; i++) {
+		j = rand()%n+1;
+	//	cout << j << ' ';
+		tree.extract(j);
+	}
+	perf.stop();
+	t = ((double)clock())/CLOCKS_PER_SEC-t;
+	cout << t << " secs" << endl;
+	perf.report(n);
+//	cout << "\nPrinting tree..." << endl;
+//	tree.print();
+	cout << "Size of tree is: " << tree.size() << endl;
+	cout << "Rotations: " << tree.rotations()-r << endl;
+	cout << "Clearing..." << endl;
+	t = ((double)clock())/CLOCKS_PER_SEC;
+	perf.start();
+	tree.clear();
+	perf.stop();
+	t = ((double)clock())/CLOCKS_PER_SEC-t;
+	cout << t << " secs" << endl;
+	perf.report(n);
+	return EXIT_SUCCESS;
+}
+
+#endif